@@ -15,6 +15,8 @@ UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussInputBlackboardAuto, "Suss.Input.Blackboa
 USussBlackboardFloatInputProvider::USussBlackboardFloatInputProvider()
 {
 	InputTag = TAG_SussInputBlackboardFloat;
+	// Blackboard values don't depend on the context, so batches only need to look them up once
+	BatchDependency = ESussInputBatchDependency::None;
 }
 
 float USussBlackboardFloatInputProvider::Evaluate_Implementation(const USussBrainComponent* Brain,
@@ -35,6 +37,8 @@ float USussBlackboardFloatInputProvider::Evaluate_Implementation(const USussBrai
 USussBlackboardBoolInputProvider::USussBlackboardBoolInputProvider()
 {
 	InputTag = TAG_SussInputBlackboardBool;
+	// Blackboard values don't depend on the context, so batches only need to look them up once
+	BatchDependency = ESussInputBatchDependency::None;
 }
 
 float USussBlackboardBoolInputProvider::Evaluate_Implementation(const USussBrainComponent* Brain,
@@ -55,6 +59,8 @@ float USussBlackboardBoolInputProvider::Evaluate_Implementation(const USussBrain
 USussBlackboardAutoInputProvider::USussBlackboardAutoInputProvider()
 {
 	InputTag = TAG_SussInputBlackboardAuto;
+	// Blackboard values don't depend on the context, so batches only need to look them up once
+	BatchDependency = ESussInputBatchDependency::None;
 }
 
 float USussBlackboardAutoInputProvider::Evaluate_Implementation(const USussBrainComponent* Brain,
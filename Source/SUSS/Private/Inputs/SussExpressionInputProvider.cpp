@@ -0,0 +1,685 @@
+﻿
+#include "Inputs/SussExpressionInputProvider.h"
+
+#include "AbilitySystemComponent.h"
+#include "AbilitySystemGlobals.h"
+#include "SussBrainComponent.h"
+#include "SussCommon.h"
+#include "SussGameSubsystem.h"
+#include "SussUtility.h"
+
+namespace
+{
+	enum class ETokenType : uint8
+	{
+		Number,
+		Identifier,
+		Operator,
+		/// Something which can't be a valid token, e.g. a malformed number
+		Invalid,
+		End
+	};
+
+	struct FToken
+	{
+		ETokenType Type = ETokenType::End;
+		FString Text;
+		float Number = 0;
+		int Pos = 0;
+	};
+
+	/// Recursive descent parser which emits bytecode as it goes
+	class FExpressionParser
+	{
+	public:
+		FExpressionParser(const FString& InSource, FSussExpression& InOut) : Source(InSource), Out(InOut) {}
+
+		bool Parse(FString& OutError)
+		{
+			Next();
+			if (ParseExpression() && Expect(ETokenType::End, TEXT("")))
+				return true;
+
+			OutError = FString::Printf(TEXT("%s at position %d"), *Error, Current.Pos);
+			return false;
+		}
+
+	protected:
+		const FString& Source;
+		FSussExpression& Out;
+		int Pos = 0;
+		FToken Current;
+		FString Error;
+		int StackDepth = 0;
+
+		void Next()
+		{
+			while (Pos < Source.Len() && FChar::IsWhitespace(Source[Pos]))
+				++Pos;
+
+			Current = FToken();
+			Current.Pos = Pos;
+			if (Pos >= Source.Len())
+				return;
+
+			const TCHAR C = Source[Pos];
+			if (FChar::IsDigit(C) || C == '.')
+			{
+				const int Start = Pos;
+				int NumDigits = 0;
+				int NumPoints = 0;
+				while (Pos < Source.Len() && (FChar::IsDigit(Source[Pos]) || Source[Pos] == '.'))
+				{
+					if (Source[Pos] == '.')
+						++NumPoints;
+					else
+						++NumDigits;
+					++Pos;
+				}
+				Current.Text = Source.Mid(Start, Pos - Start);
+				// Atof would silently stop at a second '.', so "1.2.3" has to be rejected here
+				if (NumDigits > 0 && NumPoints <= 1)
+				{
+					Current.Type = ETokenType::Number;
+					Current.Number = FCString::Atof(*Current.Text);
+				}
+				else
+				{
+					Current.Type = ETokenType::Invalid;
+				}
+			}
+			else if (FChar::IsAlpha(C) || C == '_')
+			{
+				const int Start = Pos;
+				while (Pos < Source.Len() && (FChar::IsAlnum(Source[Pos]) || Source[Pos] == '_' || Source[Pos] == '.'))
+					++Pos;
+				Current.Type = ETokenType::Identifier;
+				Current.Text = Source.Mid(Start, Pos - Start);
+			}
+			else
+			{
+				Current.Type = ETokenType::Operator;
+				Current.Text = FString::Chr(C);
+				++Pos;
+			}
+		}
+
+		bool IsOperator(const TCHAR* Op) const
+		{
+			return Current.Type == ETokenType::Operator && Current.Text == Op;
+		}
+
+		bool Expect(ETokenType Type, const TCHAR* Text)
+		{
+			if (Current.Type != Type || (Type == ETokenType::Operator && Current.Text != Text))
+			{
+				Error = Type == ETokenType::End ?
+					FString::Printf(TEXT("Unexpected '%s'"), *Current.Text) :
+					FString::Printf(TEXT("Expected '%s'"), Text);
+				return false;
+			}
+			Next();
+			return true;
+		}
+
+		void Emit(ESussExpressionOp Op, int Arg = 0)
+		{
+			Out.Code.Add(FSussExpressionInstruction { Op, Arg });
+			switch (Op)
+			{
+			case ESussExpressionOp::PushConstant:
+			case ESussExpressionOp::PushOperand:
+				++StackDepth;
+				break;
+			case ESussExpressionOp::Negate:
+			case ESussExpressionOp::Abs:
+				break;
+			case ESussExpressionOp::Clamp:
+				StackDepth -= 2;
+				break;
+			default:
+				--StackDepth;
+				break;
+			}
+			Out.MaxStackDepth = FMath::Max(Out.MaxStackDepth, StackDepth);
+		}
+
+		// expr := term (('+'|'-') term)*
+		bool ParseExpression()
+		{
+			if (!ParseTerm())
+				return false;
+
+			while (IsOperator(TEXT("+")) || IsOperator(TEXT("-")))
+			{
+				const bool bAdd = IsOperator(TEXT("+"));
+				Next();
+				if (!ParseTerm())
+					return false;
+				Emit(bAdd ? ESussExpressionOp::Add : ESussExpressionOp::Subtract);
+			}
+			return true;
+		}
+
+		// term := unary (('*'|'/') unary)*
+		bool ParseTerm()
+		{
+			if (!ParseUnary())
+				return false;
+
+			while (IsOperator(TEXT("*")) || IsOperator(TEXT("/")))
+			{
+				const bool bMultiply = IsOperator(TEXT("*"));
+				Next();
+				if (!ParseUnary())
+					return false;
+				Emit(bMultiply ? ESussExpressionOp::Multiply : ESussExpressionOp::Divide);
+			}
+			return true;
+		}
+
+		// unary := '-' unary | primary
+		bool ParseUnary()
+		{
+			if (IsOperator(TEXT("-")))
+			{
+				Next();
+				if (!ParseUnary())
+					return false;
+				Emit(ESussExpressionOp::Negate);
+				return true;
+			}
+			return ParsePrimary();
+		}
+
+		// primary := number | '(' expr ')' | function '(' args ')' | identifier
+		bool ParsePrimary()
+		{
+			if (Current.Type == ETokenType::Number)
+			{
+				Emit(ESussExpressionOp::PushConstant, Out.Constants.Add(Current.Number));
+				Next();
+				return true;
+			}
+			if (IsOperator(TEXT("(")))
+			{
+				Next();
+				return ParseExpression() && Expect(ETokenType::Operator, TEXT(")"));
+			}
+			if (Current.Type == ETokenType::Identifier)
+			{
+				const FString Identifier = Current.Text;
+				Next();
+				if (IsOperator(TEXT("(")))
+				{
+					return ParseFunction(Identifier);
+				}
+				return ParseOperand(Identifier);
+			}
+
+			if (Current.Type == ETokenType::Invalid)
+			{
+				Error = FString::Printf(TEXT("Malformed number '%s'"), *Current.Text);
+			}
+			else
+			{
+				Error = Current.Type == ETokenType::End ? TEXT("Unexpected end of expression") : FString::Printf(TEXT("Unexpected '%s'"), *Current.Text);
+			}
+			return false;
+		}
+
+		bool ParseFunction(const FString& Name)
+		{
+			ESussExpressionOp Op;
+			int NumArgs;
+			if (Name == TEXT("min"))
+			{
+				Op = ESussExpressionOp::Min;
+				NumArgs = 2;
+			}
+			else if (Name == TEXT("max"))
+			{
+				Op = ESussExpressionOp::Max;
+				NumArgs = 2;
+			}
+			else if (Name == TEXT("abs"))
+			{
+				Op = ESussExpressionOp::Abs;
+				NumArgs = 1;
+			}
+			else if (Name == TEXT("clamp"))
+			{
+				Op = ESussExpressionOp::Clamp;
+				NumArgs = 3;
+			}
+			else
+			{
+				Error = FString::Printf(TEXT("Unknown function '%s'"), *Name);
+				return false;
+			}
+
+			Next(); // (
+			for (int i = 0; i < NumArgs; ++i)
+			{
+				if (i > 0 && !Expect(ETokenType::Operator, TEXT(",")))
+					return false;
+				if (!ParseExpression())
+					return false;
+			}
+			if (!Expect(ETokenType::Operator, TEXT(")")))
+				return false;
+
+			Emit(Op);
+			return true;
+		}
+
+		static bool FindAttribute(const FString& Name, FGameplayAttribute& OutAttribute)
+		{
+			// Either "Attribute" or "AttributeSetClass.Attribute"
+			FString SetName, AttributeName;
+			if (!Name.Split(TEXT("."), &SetName, &AttributeName))
+			{
+				AttributeName = Name;
+			}
+
+			for (TObjectIterator<UClass> It; It; ++It)
+			{
+				if (!It->IsChildOf(UAttributeSet::StaticClass()) || (!SetName.IsEmpty() && It->GetName() != SetName))
+					continue;
+
+				for (TFieldIterator<FProperty> PropIt(*It, EFieldIteratorFlags::ExcludeSuper); PropIt; ++PropIt)
+				{
+					if (PropIt->GetName() == AttributeName &&
+						(FGameplayAttribute::IsGameplayAttributeDataProperty(*PropIt) || CastField<FFloatProperty>(*PropIt)))
+					{
+						OutAttribute = FGameplayAttribute(*PropIt);
+						return true;
+					}
+				}
+			}
+			return false;
+		}
+
+		bool ParseOperand(const FString& Identifier)
+		{
+			// Same identifier used more than once only needs to be gathered once
+			const int Existing = Out.Operands.IndexOfByPredicate([&Identifier](const FSussExpressionOperand& Operand)
+			{
+				return Operand.Identifier == Identifier;
+			});
+			if (Existing != INDEX_NONE)
+			{
+				Emit(ESussExpressionOp::PushOperand, Existing);
+				return true;
+			}
+
+			FString Prefix, Rest;
+			if (!Identifier.Split(TEXT("."), &Prefix, &Rest) || Rest.IsEmpty())
+			{
+				Error = FString::Printf(TEXT("Unknown value '%s'"), *Identifier);
+				return false;
+			}
+
+			FSussExpressionOperand Operand;
+			Operand.Identifier = Identifier;
+			if (Prefix == TEXT("Input"))
+			{
+				Operand.Type = ESussExpressionOperandType::Input;
+				Operand.InputTag = FGameplayTag::RequestGameplayTag(FName(TEXT("Suss.Input.") + Rest), false);
+				if (!Operand.InputTag.IsValid())
+				{
+					Error = FString::Printf(TEXT("Unknown input tag 'Suss.Input.%s'"), *Rest);
+					return false;
+				}
+			}
+			else if (Prefix == TEXT("Attr") || Prefix == TEXT("TargetAttr"))
+			{
+				Operand.Type = Prefix == TEXT("Attr") ? ESussExpressionOperandType::SelfAttribute : ESussExpressionOperandType::TargetAttribute;
+				if (!FindAttribute(Rest, Operand.Attribute))
+				{
+					Error = FString::Printf(TEXT("Unknown attribute '%s'"), *Rest);
+					return false;
+				}
+			}
+			else if (Prefix == TEXT("Param"))
+			{
+				Operand.Type = ESussExpressionOperandType::Parameter;
+				Operand.Name = FName(Rest);
+			}
+			else if (Prefix == TEXT("Location"))
+			{
+				Operand.Type = ESussExpressionOperandType::Location;
+				Operand.Axis = Rest == TEXT("X") ? 0 : Rest == TEXT("Y") ? 1 : Rest == TEXT("Z") ? 2 : INDEX_NONE;
+				if (Operand.Axis == INDEX_NONE)
+				{
+					Error = FString::Printf(TEXT("Unknown location component '%s'"), *Rest);
+					return false;
+				}
+			}
+			else if (Prefix == TEXT("Named"))
+			{
+				Operand.Type = ESussExpressionOperandType::NamedValue;
+				Operand.Name = FName(Rest);
+			}
+			else
+			{
+				Error = FString::Printf(TEXT("Unknown value '%s'"), *Identifier);
+				return false;
+			}
+
+			Emit(ESussExpressionOp::PushOperand, Out.Operands.Add(Operand));
+			return true;
+		}
+	};
+
+	float GetAttributeValue(const AActor* FromActor, const FGameplayAttribute& Attribute)
+	{
+		if (IsValid(FromActor))
+		{
+			if (const auto ASC = UAbilitySystemGlobals::GetAbilitySystemComponentFromActor(FromActor))
+			{
+				return ASC->GetNumericAttribute(Attribute);
+			}
+		}
+		return 0;
+	}
+}
+
+bool FSussExpression::Compile(const FString& Source, FString& OutError)
+{
+	Reset();
+
+	FExpressionParser Parser(Source, *this);
+	if (!Parser.Parse(OutError))
+	{
+		Reset();
+		return false;
+	}
+	return true;
+}
+
+void FSussExpression::Reset()
+{
+	Code.Reset();
+	Constants.Reset();
+	Operands.Reset();
+	MaxStackDepth = 0;
+}
+
+void FSussExpression::GatherOperand(const FSussExpressionOperand& Operand,
+	const USussBrainComponent* Brain,
+	TConstArrayView<const FSussContext*> Contexts,
+	const TMap<FName, FSussParameter>& Parameters,
+	TArrayView<float> OutValues) const
+{
+	const int Num = Contexts.Num();
+	switch (Operand.Type)
+	{
+	case ESussExpressionOperandType::Input:
+		{
+			auto SUSS = Brain ? GetSUSS(Brain->GetWorld()) : nullptr;
+			if (const USussInputProvider* Provider = SUSS ? SUSS->GetInputProvider(Operand.InputTag) : nullptr)
+			{
+				Provider->EvaluateBatchMemoised(Brain, Contexts, Parameters, OutValues);
+			}
+			else
+			{
+				FMemory::Memzero(OutValues.GetData(), Num * sizeof(float));
+			}
+			break;
+		}
+	case ESussExpressionOperandType::SelfAttribute:
+		for (int i = 0; i < Num; ++i)
+		{
+			// Self is almost always the same for every context
+			OutValues[i] = (i > 0 && Contexts[i]->ControlledActor == Contexts[i-1]->ControlledActor) ?
+				OutValues[i-1] : GetAttributeValue(Contexts[i]->ControlledActor, Operand.Attribute);
+		}
+		break;
+	case ESussExpressionOperandType::TargetAttribute:
+		for (int i = 0; i < Num; ++i)
+		{
+			OutValues[i] = GetAttributeValue(Contexts[i]->Target.Get(), Operand.Attribute);
+		}
+		break;
+	case ESussExpressionOperandType::Parameter:
+		{
+			float Value = 0;
+			if (const FSussParameter* pParam = Parameters.Find(Operand.Name))
+			{
+				USussUtility::GetSussParameterValueAsFloat(*pParam, Value);
+			}
+			for (int i = 0; i < Num; ++i)
+			{
+				OutValues[i] = Value;
+			}
+			break;
+		}
+	case ESussExpressionOperandType::Location:
+		for (int i = 0; i < Num; ++i)
+		{
+			OutValues[i] = (float)Contexts[i]->Location[Operand.Axis];
+		}
+		break;
+	case ESussExpressionOperandType::NamedValue:
+		for (int i = 0; i < Num; ++i)
+		{
+			float Value = 0;
+			if (const FSussContextValue* pValue = Contexts[i]->NamedValues.Find(Operand.Name))
+			{
+				if (pValue->Type == ESussContextValueType::Float)
+					Value = pValue->Value.Get<float>();
+				else if (pValue->Type == ESussContextValueType::Int)
+					Value = (float)pValue->Value.Get<int>();
+			}
+			OutValues[i] = Value;
+		}
+		break;
+	}
+}
+
+void FSussExpression::EvaluateBatch(const USussBrainComponent* Brain,
+	TConstArrayView<const FSussContext*> Contexts,
+	const TMap<FName, FSussParameter>& Parameters,
+	TArrayView<float> OutValues,
+	TArray<float>& Scratch) const
+{
+	check(Contexts.Num() == OutValues.Num());
+
+	const int Num = Contexts.Num();
+	if (Num == 0)
+		return;
+
+	if (!IsValid())
+	{
+		FMemory::Memzero(OutValues.GetData(), Num * sizeof(float));
+		return;
+	}
+
+	// Scratch holds a column of Num values per operand, then per stack entry
+	Scratch.SetNumUninitialized((Operands.Num() + MaxStackDepth) * Num);
+	float* OperandValues = Scratch.GetData();
+	float* Stack = OperandValues + Operands.Num() * Num;
+
+	// Gather all operands for all contexts first
+	for (int o = 0; o < Operands.Num(); ++o)
+	{
+		GatherOperand(Operands[o], Brain, Contexts, Parameters, TArrayView<float>(OperandValues + o * Num, Num));
+	}
+
+	int SP = 0;
+	for (const FSussExpressionInstruction& Instr : Code)
+	{
+		switch (Instr.Op)
+		{
+		case ESussExpressionOp::PushConstant:
+			{
+				float* Dst = Stack + SP++ * Num;
+				const float Value = Constants[Instr.Arg];
+				for (int i = 0; i < Num; ++i)
+					Dst[i] = Value;
+				break;
+			}
+		case ESussExpressionOp::PushOperand:
+			FMemory::Memcpy(Stack + SP++ * Num, OperandValues + Instr.Arg * Num, Num * sizeof(float));
+			break;
+		case ESussExpressionOp::Negate:
+			{
+				float* A = Stack + (SP - 1) * Num;
+				for (int i = 0; i < Num; ++i)
+					A[i] = -A[i];
+				break;
+			}
+		case ESussExpressionOp::Abs:
+			{
+				float* A = Stack + (SP - 1) * Num;
+				for (int i = 0; i < Num; ++i)
+					A[i] = FMath::Abs(A[i]);
+				break;
+			}
+		case ESussExpressionOp::Clamp:
+			{
+				float* X = Stack + (SP - 3) * Num;
+				const float* Lo = X + Num;
+				const float* Hi = Lo + Num;
+				for (int i = 0; i < Num; ++i)
+					X[i] = FMath::Clamp(X[i], Lo[i], Hi[i]);
+				SP -= 2;
+				break;
+			}
+		default:
+			{
+				// Binary ops
+				float* A = Stack + (SP - 2) * Num;
+				const float* B = A + Num;
+				switch (Instr.Op)
+				{
+				case ESussExpressionOp::Add:
+					for (int i = 0; i < Num; ++i)
+						A[i] += B[i];
+					break;
+				case ESussExpressionOp::Subtract:
+					for (int i = 0; i < Num; ++i)
+						A[i] -= B[i];
+					break;
+				case ESussExpressionOp::Multiply:
+					for (int i = 0; i < Num; ++i)
+						A[i] *= B[i];
+					break;
+				case ESussExpressionOp::Divide:
+					for (int i = 0; i < Num; ++i)
+						A[i] = B[i] != 0 ? A[i] / B[i] : 0;
+					break;
+				case ESussExpressionOp::Min:
+					for (int i = 0; i < Num; ++i)
+						A[i] = FMath::Min(A[i], B[i]);
+					break;
+				case ESussExpressionOp::Max:
+					for (int i = 0; i < Num; ++i)
+						A[i] = FMath::Max(A[i], B[i]);
+					break;
+				default:
+					break;
+				}
+				--SP;
+				break;
+			}
+		}
+	}
+
+	check(SP == 1);
+	FMemory::Memcpy(OutValues.GetData(), Stack, Num * sizeof(float));
+}
+
+namespace
+{
+	/// Expression inputs being evaluated on this thread, outermost first. Catches indirect cycles (A uses Input.B,
+	/// B uses Input.A) which can't be seen when compiling one expression on its own
+	thread_local TArray<const USussExpressionInputProvider*, TInlineAllocator<8>> GEvaluatingExpressions;
+	/// Scratch per nesting depth, so that nested evaluations don't overwrite values outer ones are still using
+	thread_local TArray<TUniquePtr<TArray<float>>> GExpressionScratchByDepth;
+}
+
+void USussExpressionInputProvider::PostInitProperties()
+{
+	Super::PostInitProperties();
+
+	// Native subclasses set their expression in the constructor, and their CDOs aren't loaded. Blueprint classes'
+	// expressions aren't known until PostLoad
+	if (HasAnyFlags(RF_ClassDefaultObject) && GetClass()->HasAnyClassFlags(CLASS_Native) && !GetClass()->HasAnyClassFlags(CLASS_Abstract))
+	{
+		CompileExpression();
+	}
+}
+
+void USussExpressionInputProvider::PostLoad()
+{
+	Super::PostLoad();
+
+	// Compile at load so errors are reported early
+	CompileExpression();
+}
+
+#if WITH_EDITOR
+void USussExpressionInputProvider::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+
+	CompileExpression();
+}
+#endif
+
+void USussExpressionInputProvider::CompileExpression()
+{
+	FString Error;
+	if (!CompiledExpression.Compile(Expression, Error))
+	{
+		UE_LOG(LogSuss, Error, TEXT("%s: invalid expression '%s': %s"), *GetName(), *Expression, *Error);
+		return;
+	}
+
+	for (const auto& Operand : CompiledExpression.Operands)
+	{
+		if (Operand.Type == ESussExpressionOperandType::Input && Operand.InputTag == InputTag)
+		{
+			UE_LOG(LogSuss, Error, TEXT("%s: expression '%s' references its own input"), *GetName(), *Expression);
+			CompiledExpression.Reset();
+			return;
+		}
+	}
+}
+
+float USussExpressionInputProvider::Evaluate_Implementation(const USussBrainComponent* Brain,
+	const FSussContext& Context,
+	const TMap<FName, FSussParameter>& Parameters) const
+{
+	float Value = 0;
+	const FSussContext* pContext = &Context;
+	EvaluateBatch(Brain, MakeArrayView(&pContext, 1), Parameters, MakeArrayView(&Value, 1));
+	return Value;
+}
+
+void USussExpressionInputProvider::EvaluateBatch(const USussBrainComponent* Brain,
+	TConstArrayView<const FSussContext*> Contexts,
+	const TMap<FName, FSussParameter>& Parameters,
+	TArrayView<float> OutValues) const
+{
+	// Compiled up front (see PostInitProperties / PostLoad), since this may be running on several threads at once
+	if (GEvaluatingExpressions.Contains(this))
+	{
+		if (!bReportedCycle.exchange(true, std::memory_order_relaxed))
+		{
+			UE_LOG(LogSuss, Error, TEXT("%s: expression '%s' references its own input via other inputs"), *GetName(), *Expression);
+		}
+		FMemory::Memzero(OutValues.GetData(), OutValues.Num() * sizeof(float));
+		return;
+	}
+
+	const int Depth = GEvaluatingExpressions.Add(this);
+	if (!GExpressionScratchByDepth.IsValidIndex(Depth))
+	{
+		GExpressionScratchByDepth.Add(MakeUnique<TArray<float>>());
+	}
+	CompiledExpression.EvaluateBatch(Brain, Contexts, Parameters, OutValues, *GExpressionScratchByDepth[Depth]);
+	GEvaluatingExpressions.Pop();
+}
@@ -34,6 +34,18 @@ float USussGameplayAttributeSelfInputProvider::Evaluate_Implementation(const USu
 	return GetAttributeValue(Context.ControlledActor);
 }
 
+USussGameplayAttributeSelfInputProvider::USussGameplayAttributeSelfInputProvider()
+{
+	// Self is almost always the same for every context in a batch, so only look up again when it changes
+	BatchDependency = ESussInputBatchDependency::Self;
+}
+
+USussGameplayAttributeTargetInputProvider::USussGameplayAttributeTargetInputProvider()
+{
+	// Target attributes are the same whoever is asking, so share them between brains
+	MemoScope = ESussInputMemoScope::Target;
+}
+
 float USussGameplayAttributeTargetInputProvider::Evaluate_Implementation(const class USussBrainComponent* Brain,
                                                                          const FSussContext& Context,
                                                                          const TMap<FName, FSussParameter>& Parameters) const
@@ -55,6 +55,18 @@ float USussGameplayTagSelfInputProvider::Evaluate_Implementation(
 	return ScoreTagsOnActor(Context.ControlledActor);
 }
 
+USussGameplayTagSelfInputProvider::USussGameplayTagSelfInputProvider()
+{
+	// Self is almost always the same for every context in a batch, so only score again when it changes
+	BatchDependency = ESussInputBatchDependency::Self;
+}
+
+USussGameplayTagTargetInputProvider::USussGameplayTagTargetInputProvider()
+{
+	// Target tags are the same whoever is asking, so share them between brains
+	MemoScope = ESussInputMemoScope::Target;
+}
+
 float USussGameplayTagTargetInputProvider::Evaluate_Implementation(
 	const class USussBrainComponent* Brain,
 	const FSussContext& Context,
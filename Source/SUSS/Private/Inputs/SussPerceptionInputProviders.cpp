@@ -15,6 +15,9 @@ UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussInputLineOfSightToTarget, "Suss.Input.Per
 USussSelfSightRangeInputProvider::USussSelfSightRangeInputProvider()
 {
 	InputTag = TAG_SussInputSelfSightRange;
+	// Sense config rarely changes, don't look it up every evaluation
+	CacheKey = ESussInputCacheKey::Self;
+	CacheTimeToLive = 1;
 }
 
 float USussSelfSightRangeInputProvider::Evaluate_Implementation(const class USussBrainComponent* Brain,
@@ -36,6 +39,9 @@ float USussSelfSightRangeInputProvider::Evaluate_Implementation(const class USus
 USussSelfHearingRangeInputProvider::USussSelfHearingRangeInputProvider()
 {
 	InputTag = TAG_SussInputSelfHearingRange;
+	// Sense config rarely changes, don't look it up every evaluation
+	CacheKey = ESussInputCacheKey::Self;
+	CacheTimeToLive = 1;
 }
 
 float USussSelfHearingRangeInputProvider::Evaluate_Implementation(const class USussBrainComponent* Brain,
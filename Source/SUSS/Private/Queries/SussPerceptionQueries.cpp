@@ -14,7 +14,8 @@ UE_DEFINE_GAMEPLAY_TAG_COMMENT(TAG_SussQueryPerceptionKnownHostilesExtended, "Su
 
 USussPerceptionKnownTargetsQueryProviderBase::USussPerceptionKnownTargetsQueryProviderBase()
 {
-	// Nothing to do here, not a concrete query
+	// Not a concrete query, but all subclasses read perception
+	bInvalidateOnPerceptionUpdate = true;
 }
 
 TSubclassOf<UAISense> USussPerceptionKnownTargetsQueryProviderBase::GetSenseClass(
@@ -172,6 +173,7 @@ FString FSussActorPerceptionInfo::ToString() const
 USussPerceptionKnownHostilesExtendedQueryProvider::USussPerceptionKnownHostilesExtendedQueryProvider()
 {
 	QueryTag = TAG_SussQueryPerceptionKnownHostilesExtended;
+	bInvalidateOnPerceptionUpdate = true;
 	QueryValueName = SUSS::PerceptionInfoValueName;
 	QueryValueType = ESussContextValueType::Struct;
 }
@@ -9,6 +9,7 @@
 #include "SussGameSubsystem.h"
 #include "SussPoolSubsystem.h"
 #include "SussSettings.h"
+#include "SussUpdateArena.h"
 #include "SussUtility.h"
 #include "SussWorldSubsystem.h"
 #include "GameFramework/Character.h"
@@ -23,7 +24,6 @@ USussBrainComponent::USussBrainComponent(): bQueuedForUpdate(false),
                                             bWasPreventedFromUpdating(false),
                                             BrainConfigAsset(nullptr),
                                             DistanceCategory(ESussDistanceCategory::OutOfRange),
-                                            CurrentUpdateInterval(0),
                                             CurrentActionResult(),
                                             PerceptionComp(nullptr)
 {
@@ -67,12 +67,10 @@ void USussBrainComponent::BeginPlay()
 	}
 
 
-	if (auto Settings = GetDefault<USussSettings>())
+	// Always listen to perception, perception-based queries need to know even if we don't update on changes
+	if (PerceptionComp)
 	{
-		if (PerceptionComp && Settings->BrainUpdateOnPerceptionChanges)
-		{
-			PerceptionComp->OnPerceptionUpdated.AddDynamic(this, &USussBrainComponent::OnPerceptionUpdated);
-		}
+		PerceptionComp->OnPerceptionUpdated.AddDynamic(this, &USussBrainComponent::OnPerceptionUpdated);
 	}
 }
 
@@ -86,8 +84,16 @@ void USussBrainComponent::StartLogic()
 
 	if (GetOwner()->HasAuthority())
 	{
+		if (auto SS = GetSussWorldSubsystem(GetWorld()))
+		{
+			SS->RegisterBrain(this);
+		}
+		
 		UpdateDistanceCategory();
 
+		// Config init below registers tag events for the config's prevent tags
+		bListenForPreventUpdateTags = true;
+
 		if (IsValid(BrainConfigAsset))
 		{
 			if (BrainConfig.ActionDefs.Num() || BrainConfig.ActionSets.Num())
@@ -100,21 +106,6 @@ void USussBrainComponent::StartLogic()
 		{
 			BrainConfigChanged();
 		}
-
-		if (BrainConfig.PreventBrainUpdateIfAnyTags.Num() > 0)
-		{
-			if (auto Pawn = GetPawn())
-			{
-				// Listen on gameplay tag changes
-				if (auto ASC = UAbilitySystemGlobals::GetAbilitySystemComponentFromActor(Pawn))
-				{
-					for (auto Tag : BrainConfig.PreventBrainUpdateIfAnyTags)
-					{
-						TagDelegates.Add(Tag, ASC->RegisterGameplayTagEvent(Tag).AddUObject(this, &USussBrainComponent::OnGameplayTagEvent));
-					}
-				}
-			}
-		}
 	}
 	
 }
@@ -143,63 +134,51 @@ float USussBrainComponent::GetDistanceToAnyPlayer() const
 	return std::numeric_limits<float>::max();
 }
 
-void USussBrainComponent::UpdateActionScoreAdjustments(float DeltaTime)
+FSussBrainStateStore& USussBrainComponent::GetBrainStates() const
 {
-	// Slowly reduce current score at a rate determined by its last run score (which includes inertia)
-	if (IsActionInProgress() && CurrentActionResult.Score > 0)
+	if (auto SS = StateSubsystem.Get())
 	{
-		const auto& ActionDef = CombinedActionsByPriority[CurrentActionResult.ActionDefIndex];
-		if (ActionDef.ScoreCooldownTime > 0)
-		{
-			auto& H = ActionHistory[CurrentActionResult.ActionDefIndex];
-			const float Decay = H.LastRunScore * (DeltaTime / ActionDef.ScoreCooldownTime);
-			CurrentActionResult.Score = FMath::Max(CurrentActionResult.Score - Decay, 0);
-		}
-		else
-		{
-			CurrentActionResult.Score = 0;
-		}
+		return SS->GetBrainStates();
 	}
+	if (LocalBrainStates.IsValid())
+	{
+		return *LocalBrainStates;
+	}
+	// Not allocated yet so there's no state; everything is a no-op / default against an invalid handle
+	static FSussBrainStateStore Unallocated;
+	return Unallocated;
+}
+
+void USussBrainComponent::EnsureBrainState()
+{
+	if (GetBrainStates().IsValid(StateHandle))
+		return;
 
-	// Deal with repetition penalties and temp score adjustments
-	for (int i = 0; i < ActionHistory.Num(); ++i)
+	if (auto SS = GetSussWorldSubsystem(GetWorld()))
 	{
-		auto& H = ActionHistory[i];
-		const auto& ActionDef = CombinedActionsByPriority[i];
-		if (H.RepetitionPenalty > 0)
-		{
-			if (i != CurrentActionResult.ActionDefIndex)
-			{
-				if (ActionDef.RepetitionPenaltyCooldown > 0)
-				{
-					// Not the current action anymore, bleed repetition penalty away
-					const float Decay = ActionDef.RepetitionPenalty * (DeltaTime / ActionDef.RepetitionPenaltyCooldown);
-					H.RepetitionPenalty = FMath::Max(H.RepetitionPenalty - Decay, 0);
-				}
-				else
-				{
-					H.RepetitionPenalty = 0;
-				}
-			}
-		}
-		// temp adjusts can be + or -
-		if (!FMath::IsNearlyZero(H.TempScoreAdjust) && !FMath::IsNearlyZero(H.TempScoreAdjustCooldownRate))
-		{
-			// temp adjusts always cool down
-			// always move towards 0
-			if (H.TempScoreAdjust > 0)
-			{
-				// positive
-				H.TempScoreAdjust = FMath::Max(H.TempScoreAdjust - H.TempScoreAdjustCooldownRate * DeltaTime, 0.0f);
-			}
-			else
-			{
-				// negative
-				H.TempScoreAdjust = FMath::Min(H.TempScoreAdjust + H.TempScoreAdjustCooldownRate * DeltaTime, 0.0f);
-			}
-		}
+		StateSubsystem = SS;
+	}
+	else if (!LocalBrainStates.IsValid())
+	{
+		// No world subsystem outside game worlds, keep our own state
+		LocalBrainStates = MakeUnique<FSussBrainStateStore>();
 	}
+	StateHandle = GetBrainStates().AllocateBrain();
+}
+
+void USussBrainComponent::FreeBrainState()
+{
+	GetBrainStates().FreeBrain(StateHandle);
+}
+
+float USussBrainComponent::GetCurrentActionScore() const
+{
+	return GetBrainStates().GetCurrentScore(StateHandle, GetWorld()->GetTimeSeconds());
+}
 
+float USussBrainComponent::GetCurrentUpdateInterval() const
+{
+	return GetBrainStates().GetUpdateInterval(StateHandle);
 }
 
 void USussBrainComponent::UpdateDistanceCategory()
@@ -233,12 +212,14 @@ void USussBrainComponent::UpdateDistanceCategory()
 
 	auto& TM = GetWorld()->GetTimerManager();
 
-	if (!UpdateRequestTimer.IsValid() || NewInterval != CurrentUpdateInterval)
+	EnsureBrainState();
+	auto& States = GetBrainStates();
+	if (!UpdateRequestTimer.IsValid() || NewInterval != States.GetUpdateInterval(StateHandle))
 	{
 		// Randomise the time that brains start their update to spread them out
 		float Delay = FMath::RandRange(0.0f, NewInterval);
 		TM.SetTimer(UpdateRequestTimer, this, &USussBrainComponent::TimerCallback, NewInterval, true, Delay);
-		CurrentUpdateInterval = NewInterval;
+		States.UpdateInterval(StateHandle) = NewInterval;
 	}
 
 	// Just in case this somehow gets called while agent is paused
@@ -246,6 +227,8 @@ void USussBrainComponent::UpdateDistanceCategory()
 	{
 		TM.PauseTimer(UpdateRequestTimer);
 	}
+	// Scores only cool down while the timer is running
+	States.SetDecayActive(StateHandle, !IsPaused(), GetWorld()->GetTimeSeconds());
 }
 
 void USussBrainComponent::StopLogic(const FString& Reason)
@@ -260,25 +243,17 @@ void USussBrainComponent::StopLogic(const FString& Reason)
 	{
 		GetWorld()->GetTimerManager().ClearTimer(UpdateRequestTimer);
 	}
+	GetBrainStates().SetDecayActive(StateHandle, false, GetWorld()->GetTimeSeconds());
 	// Note: we could have already queued an update, so that will need to be handled on Update
 
-	if (TagDelegates.Num() > 0)
+	if (auto SS = GetSussWorldSubsystem(GetWorld()))
 	{
-		if (const auto Pawn = GetPawn())
-		{
-			// Listen on gameplay tag changes
-			if (const auto ASC = UAbilitySystemGlobals::GetAbilitySystemComponentFromActor(Pawn))
-			{
-				for (const auto Pair : TagDelegates)
-				{
-					ASC->UnregisterGameplayTagEvent(Pair.Value, Pair.Key);
-				}
-			}
-		}
-
-		TagDelegates.Empty();
+		SS->UnregisterBrain(this);
 	}
 
+	bListenForPreventUpdateTags = false;
+	UnregisterPreventUpdateTagEvents();
+
 }
 
 void USussBrainComponent::RestartLogic()
@@ -302,6 +277,7 @@ void USussBrainComponent::PauseLogic(const FString& Reason)
 	if (UpdateRequestTimer.IsValid())
 	{
 		GetWorld()->GetTimerManager().PauseTimer(UpdateRequestTimer);
+		GetBrainStates().SetDecayActive(StateHandle, false, GetWorld()->GetTimeSeconds());
 	}
 }
 
@@ -314,6 +290,7 @@ EAILogicResuming::Type USussBrainComponent::ResumeLogic(const FString& Reason)
 		if (UpdateRequestTimer.IsValid())
 		{
 			GetWorld()->GetTimerManager().UnPauseTimer(UpdateRequestTimer);
+			GetBrainStates().SetDecayActive(StateHandle, true, GetWorld()->GetTimeSeconds());
 		}
 
 		bIsLogicStopped = false;
@@ -323,34 +300,90 @@ EAILogicResuming::Type USussBrainComponent::ResumeLogic(const FString& Reason)
 	return Ret;
 }
 
-void USussBrainComponent::InitActions()
+bool FSussActionTable::IsBuiltFrom(const FSussBrainConfig& Config) const
 {
-	// Collate all the actions from referenced action sets, and actions only on this instance
-	CombinedActionsByPriority.Empty();
-	for (auto ActionSet : BrainConfig.ActionSets)
+	if (SourceActionSets.Num() != Config.ActionSets.Num() || SourceActionDefs.Num() != Config.ActionDefs.Num())
+		return false;
+
+	for (int i = 0; i < SourceActionSets.Num(); ++i)
 	{
-		// Guard against bad config
-		if (IsValid(ActionSet))
-		{
-			for (auto& Action : ActionSet->GetActions())
-			{
-				CombinedActionsByPriority.Add(Action);
-			}
-		}
+		if (SourceActionSets[i].Get() != Config.ActionSets[i])
+			return false;
+	}
+
+	const UScriptStruct* DefStruct = FSussActionDef::StaticStruct();
+	for (int i = 0; i < SourceActionDefs.Num(); ++i)
+	{
+		if (!DefStruct->CompareScriptStruct(&SourceActionDefs[i], &Config.ActionDefs[i], PPF_None))
+			return false;
+	}
+	return true;
+}
+
+uint32 FSussActionTable::HashConfigActions(const FSussBrainConfig& Config)
+{
+	// Doesn't need to be exhaustive, IsBuiltFrom does a full comparison
+	uint32 Hash = GetTypeHash(Config.ActionSets.Num());
+	for (auto ActionSet : Config.ActionSets)
+	{
+		Hash = HashCombine(Hash, GetTypeHash(ActionSet));
+	}
+	for (const auto& Def : Config.ActionDefs)
+	{
+		Hash = HashCombine(Hash, GetTypeHash(Def.ActionTag));
+		Hash = HashCombine(Hash, GetTypeHash(Def.Priority));
 	}
-	for (auto& Action : BrainConfig.ActionDefs)
+	return Hash;
+}
+
+void USussBrainComponent::InitActions()
+{
+	// The combined, sorted & compiled actions are shared with every other brain using the same actions
+	auto SUSS = GetSUSS(GetWorld());
+	ActionTable = SUSS ? SUSS->GetActionTable(BrainConfig, [this](const FSussActionDef& Action, FSussCompiledAction& OutCompiled)
+	{
+		CompileAction(Action, OutCompiled);
+	}) : nullptr;
+
+	// Init history, which lives with other brains' in the state store
+	EnsureBrainState();
+	auto& States = GetBrainStates();
+	States.SetNumActions(StateHandle, GetActionDefs().Num());
+	const TArrayView<float> PenaltyDecayRates = States.GetRepetitionPenaltyDecayRates(StateHandle);
+	for (int i = 0; i < GetActionDefs().Num(); ++i)
 	{
-		CombinedActionsByPriority.Add(Action);
+		const auto& Def = GetActionDefs()[i];
+		// No cooldown means the penalty goes straight away once the action isn't current
+		PenaltyDecayRates[i] = Def.RepetitionPenaltyCooldown > 0 ? Def.RepetitionPenalty / Def.RepetitionPenaltyCooldown : UE_BIG_NUMBER;
 	}
 
-	// Sort by ascending priority
-	CombinedActionsByPriority.Sort([](const FSussActionDef& A, const FSussActionDef& B)
+	// Per-tag aggregate of the history we kept
+	LastEndTimeByTag.Reset();
+	if (ActionTable.IsValid())
 	{
-		return A.Priority < B.Priority;
-	});
+		LastEndTimeByTag.Init(-UE_DOUBLE_BIG_NUMBER, ActionTable->ActionIndicesByTag.Num());
+		const TConstArrayView<double> LastEndTimes = States.GetLastEndTimes(StateHandle);
+		for (int i = 0; i < LastEndTimes.Num(); ++i)
+		{
+			double& TagEndTime = LastEndTimeByTag[ActionTable->ActionTagIndexPerAction[i]];
+			TagEndTime = FMath::Max(TagEndTime, LastEndTimes[i]);
+		}
+	}
+
+	InitGatingTags();
 
-	// Init history
-	ActionHistory.SetNum(CombinedActionsByPriority.Num());
+	// Previously generated contexts are for the old action list
+	CachedActionContexts.Reset();
+	CachedActionContexts.SetNum(GetActionDefs().Num());
+
+	// Create action instances ahead of time so the first use of each doesn't hitch; actions only run on the server
+	if (GetOwner() && GetOwner()->HasAuthority())
+	{
+		if (auto Pool = GetSussPool(GetWorld()))
+		{
+			Pool->PrewarmActions(GetActionDefs(), GetDefault<USussSettings>()->ActionPrewarmCountPerClass);
+		}
+	}
 }
 
 ESussActionChoiceMethod USussBrainComponent::GetActionChoiceMethod(int Priority, int& OutTopN) const
@@ -464,28 +497,114 @@ FSussActorPerceptionInfo USussBrainComponent::GetMostRecentPerceptionInfo(bool&
 UE_ENABLE_OPTIMIZATION
 bool USussBrainComponent::IsUpdatePrevented() const
 {
-	if (BrainConfig.PreventBrainUpdateIfAnyTags.Num() > 0)
+	// Owned prevent tags are kept up to date by OnGameplayTagEvent
+	return PreventUpdateTagBits.Intersects(OwnedGatingTags);
+}
+
+void USussBrainComponent::InitGatingTags()
+{
+	NumActionGatingTags = ActionTable.IsValid() ? ActionTable->GatingTags.Num() : 0;
+	const auto& PreventTags = BrainConfig.PreventBrainUpdateIfAnyTags.GetGameplayTagArray();
+	OwnedGatingTags.Init(NumActionGatingTags + PreventTags.Num());
+	PreventUpdateTagBits.Init(NumActionGatingTags + PreventTags.Num());
+
+	for (int i = 0; i < PreventTags.Num(); ++i)
+	{
+		PreventUpdateTagBits.Set(NumActionGatingTags + i);
+	}
+
+	// Prevent tags may have changed with the config, so tag events need registering again
+	RefreshPreventUpdateTags();
+}
+
+void USussBrainComponent::RefreshPreventUpdateTags()
+{
+	UnregisterPreventUpdateTagEvents();
+
+	const auto& PreventTags = BrainConfig.PreventBrainUpdateIfAnyTags.GetGameplayTagArray();
+	if (PreventTags.Num() == 0)
+		return;
+
+	// Like tag events, prevent tags are only tracked via the ability system
+	const auto Pawn = GetPawn();
+	const auto ASC = Pawn ? UAbilitySystemGlobals::GetAbilitySystemComponentFromActor(Pawn) : nullptr;
+	PreventUpdateTagsASC = ASC;
+	for (int i = 0; i < PreventTags.Num(); ++i)
 	{
-		if (auto Pawn = GetPawn())
+		// Snapshot now, tag events keep it up to date from here on
+		OwnedGatingTags.Set(NumActionGatingTags + i, ASC && ASC->HasMatchingGameplayTag(PreventTags[i]));
+		if (ASC && bListenForPreventUpdateTags)
 		{
-			// Listen on gameplay tag changes
-			if (auto ASC = UAbilitySystemGlobals::GetAbilitySystemComponentFromActor(Pawn))
-			{
-				if (ASC->HasAnyMatchingGameplayTags(BrainConfig.PreventBrainUpdateIfAnyTags))
-				{
-					return true;
-				}
-			}
+			TagDelegates.Add(PreventTags[i], ASC->RegisterGameplayTagEvent(PreventTags[i]).AddUObject(this, &USussBrainComponent::OnGameplayTagEvent));
 		}
 	}
+}
 
-	return false;
+void USussBrainComponent::UnregisterPreventUpdateTagEvents()
+{
+	// Registered with the ability system we looked up at the time, the pawn may have changed since
+	if (const auto ASC = PreventUpdateTagsASC.Get())
+	{
+		for (const auto& Pair : TagDelegates)
+		{
+			ASC->UnregisterGameplayTagEvent(Pair.Value, Pair.Key);
+		}
+	}
+	TagDelegates.Empty();
+	PreventUpdateTagsASC.Reset();
+}
+
+void USussBrainComponent::RefreshPreventUpdateTagsIfPawnChanged()
+{
+	if (!bListenForPreventUpdateTags || BrainConfig.PreventBrainUpdateIfAnyTags.Num() == 0)
+		return;
+
+	const auto Pawn = GetPawn();
+	const auto ASC = Pawn ? UAbilitySystemGlobals::GetAbilitySystemComponentFromActor(Pawn) : nullptr;
+	if (ASC != PreventUpdateTagsASC.Get())
+	{
+		RefreshPreventUpdateTags();
+	}
+}
+
+void USussBrainComponent::UpdateOwnedActionGatingTags()
+{
+	if (NumActionGatingTags == 0)
+		return;
+
+	// One lookup of where tags come from, then one match per tag rather than per action
+	AActor* Owner = GetOwner();
+	const auto& GatingTags = ActionTable->GatingTags;
+	// Prefer Ability system if present
+	if (UAbilitySystemComponent* const ASC = UAbilitySystemGlobals::GetAbilitySystemComponentFromActor(Owner))
+	{
+		for (int i = 0; i < NumActionGatingTags; ++i)
+		{
+			OwnedGatingTags.Set(i, ASC->HasMatchingGameplayTag(GatingTags[i]));
+		}
+	}
+	else if (auto TI = Cast<IGameplayTagAssetInterface>(Owner))
+	{
+		for (int i = 0; i < NumActionGatingTags; ++i)
+		{
+			OwnedGatingTags.Set(i, TI->HasMatchingGameplayTag(GatingTags[i]));
+		}
+	}
+	else
+	{
+		for (int i = 0; i < NumActionGatingTags; ++i)
+		{
+			OwnedGatingTags.Set(i, false);
+		}
+	}
 }
 
 void USussBrainComponent::QueueForUpdate()
 {
 	if (!bQueuedForUpdate)
 	{
+		// Owned prevent tags are only tracked for the pawn we registered with
+		RefreshPreventUpdateTagsIfPawnChanged();
 		if (IsUpdatePrevented())
 		{
 			bWasPreventedFromUpdating = true;
@@ -505,6 +624,12 @@ void USussBrainComponent::QueueForUpdate()
 void USussBrainComponent::OnGameplayTagEvent(const FGameplayTag InTag, int32 NewCount)
 {
 	// By nature this has to be one of the brain config's prevent update tags
+	const int32 PreventIndex = BrainConfig.PreventBrainUpdateIfAnyTags.GetGameplayTagArray().IndexOfByKey(InTag);
+	if (PreventIndex != INDEX_NONE && PreventUpdateTagBits.Words.Num() > 0)
+	{
+		OwnedGatingTags.Set(NumActionGatingTags + PreventIndex, NewCount > 0);
+	}
+
 	// We don't need to check > 0 because that's checked on update
 	// We just need to check if we need to immediately update
 	if (NewCount == 0 && bWasPreventedFromUpdating)
@@ -516,7 +641,7 @@ void USussBrainComponent::OnGameplayTagEvent(const FGameplayTag InTag, int32 New
 
 void USussBrainComponent::TimerCallback()
 {
-	UpdateActionScoreAdjustments(CurrentUpdateInterval);
+	// Score adjustments cool down by themselves, they're evaluated from elapsed time when read
 	UpdateDistanceCategory();
 
 	// We still get timer callbacks for being out of range, we simply check the distance
@@ -534,7 +659,7 @@ void USussBrainComponent::ChooseActionFromCandidates()
 		UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("No candidate actions"));
 		if (IsActionInProgress())
 		{
-			const FSussActionDef& CurrentActionDef =  CombinedActionsByPriority[CurrentActionResult.ActionDefIndex];
+			const FSussActionDef& CurrentActionDef =  GetActionDefs()[CurrentActionResult.ActionDefIndex];
 			UE_VLOG(GetLogOwner(),
 			        LogSuss,
 			        Log,
@@ -549,55 +674,75 @@ void USussBrainComponent::ChooseActionFromCandidates()
 		return;
 	}
 
-	CandidateActions.Sort([](const FSussActionScoringResult& L, const FSussActionScoringResult& R)
-	{
-		// sort from highest to lowest
-		return L.Score > R.Score;
-	});
-
 	// All actions in the candidate list will always be from the same priority group
-	const int Priority = CombinedActionsByPriority[CandidateActions[0].ActionDefIndex].Priority;
+	const int Priority = GetActionDefs()[CandidateActions[0].ActionDefIndex].Priority;
 	int TopN = 0;
 	ESussActionChoiceMethod ChoiceMethod = GetActionChoiceMethod(Priority, TopN);
 
+	// Nothing needs sorting; best is a running max, top N a bounded heap, top N percent a filter on the best score
+	int BestIndex = 0;
+	for (int i = 1; i < CandidateActions.Num(); ++i)
+	{
+		if (CandidateActions[i].Score > CandidateActions[BestIndex].Score)
+		{
+			BestIndex = i;
+		}
+	}
+
 	if (ChoiceMethod == ESussActionChoiceMethod::HighestScoring)
 	{
 #if ENABLE_VISUAL_LOG
 		UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("Choice method: Highest Scoring"));
 #endif
-		ChooseAction(CandidateActions[0]);
+		ChooseAction(CandidateActions[BestIndex]);
 	}
 	else
 	{
 		// Weighted random of some kind
-		float TotalScores = 0;
-		int ChoiceCount = 0;
-		const float BestScore = CandidateActions[0].Score;
-		const float ScoreLimit = ChoiceMethod == ESussActionChoiceMethod::WeightedRandomTopNPercent ?
-			BestScore - (BestScore * ((float)TopN / 100.0f)): 0;
-		for (int i = 0; i < CandidateActions.Num(); ++i, ++ChoiceCount)
+		CandidateChoiceScratch.Reset();
+		if (ChoiceMethod == ESussActionChoiceMethod::WeightedRandomTopN)
 		{
-			if (ChoiceMethod == ESussActionChoiceMethod::WeightedRandomTopN)
+			// Min-heap of the best N so far, so the worst of them is on top to be replaced
+			const auto WorseScore = [this](int L, int R)
+			{
+				return CandidateActions[L].Score < CandidateActions[R].Score;
+			};
+			for (int i = 0; i < CandidateActions.Num() && TopN > 0; ++i)
 			{
-				if (i == TopN)
+				if (CandidateChoiceScratch.Num() < TopN)
+				{
+					CandidateChoiceScratch.HeapPush(i, WorseScore);
+				}
+				else if (CandidateActions[i].Score > CandidateActions[CandidateChoiceScratch.HeapTop()].Score)
 				{
-					break;
+					CandidateChoiceScratch.HeapPopDiscard(WorseScore);
+					CandidateChoiceScratch.HeapPush(i, WorseScore);
 				}
 			}
-			else if (ChoiceMethod == ESussActionChoiceMethod::WeightedRandomTopNPercent)
+		}
+		else
+		{
+			const float BestScore = CandidateActions[BestIndex].Score;
+			const float ScoreLimit = ChoiceMethod == ESussActionChoiceMethod::WeightedRandomTopNPercent ?
+				BestScore - (BestScore * ((float)TopN / 100.0f)): 0;
+			for (int i = 0; i < CandidateActions.Num(); ++i)
 			{
-				if (CandidateActions[i].Score < ScoreLimit)
+				if (ChoiceMethod != ESussActionChoiceMethod::WeightedRandomTopNPercent || CandidateActions[i].Score >= ScoreLimit)
 				{
-					break;
+					CandidateChoiceScratch.Add(i);
 				}
 			}
+		}
 
+		float TotalScores = 0;
+		for (const int i : CandidateChoiceScratch)
+		{
 			TotalScores += CandidateActions[i].Score;
 		}
 
 		const float Rand = FMath::RandRange(0.0f, TotalScores);
 		float ScoreAccum = 0;
-		for (int i = 0; i < ChoiceCount; ++i)
+		for (const int i : CandidateChoiceScratch)
 		{
 			ScoreAccum += CandidateActions[i].Score;
 
@@ -618,6 +763,19 @@ void USussBrainComponent::ChooseActionFromCandidates()
 	}
 }
 
+const FSussContext& USussBrainComponent::GetCandidateContext(const FSussActionCandidate& Candidate) const
+{
+	return Candidate.ContextIndex == INDEX_NONE ?
+		CurrentActionResult.Context :
+		CachedActionContexts[Candidate.ActionDefIndex].Contexts[Candidate.ContextIndex];
+}
+
+void USussBrainComponent::ChooseAction(const FSussActionCandidate& Candidate)
+{
+	// Only the winner's context gets copied
+	ChooseAction(FSussActionScoringResult { Candidate.ActionDefIndex, GetCandidateContext(Candidate), Candidate.Score });
+}
+
 void USussBrainComponent::StopCurrentAction()
 {
 	CancelCurrentAction(nullptr);
@@ -631,46 +789,127 @@ void USussBrainComponent::CancelCurrentAction(TSubclassOf<USussAction> Interrupt
 		CurrentActionInstance->CancelAction(Interrupter);
 		RecordAndResetCurrentAction();
 	}
+	else if (CurrentNativeAction)
+	{
+		// Like unbinding above, so that the action completing itself while cancelling doesn't record it twice
+		FSussNativeAction* NativeAction = CurrentNativeAction;
+		CurrentNativeAction = nullptr;
+		NativeAction->CancelAction(Interrupter);
+		RecordAndResetCurrentAction();
+		DeferDestroyNativeActionStorage();
+	}
+}
+
+bool USussBrainComponent::CanCurrentActionBeInterrupted() const
+{
+	if (CurrentActionInstance.IsValid())
+		return CurrentActionInstance->CanBeInterrupted();
+	if (CurrentNativeAction)
+		return CurrentNativeAction->CanBeInterrupted();
+	return true;
+}
+
+bool USussBrainComponent::CurrentActionAllowsInterruptionsFromHigherPriorityGroupsOnly() const
+{
+	if (CurrentActionInstance.IsValid())
+		return CurrentActionInstance->AllowInterruptionsFromHigherPriorityGroupsOnly();
+	if (CurrentNativeAction)
+		return CurrentNativeAction->AllowInterruptionsFromHigherPriorityGroupsOnly();
+	return false;
+}
+
+void USussBrainComponent::DestroyNativeActionStorage()
+{
+	if (bNativeActionStorageInUse)
+	{
+		reinterpret_cast<FSussNativeAction*>(&NativeActionStorage)->~FSussNativeAction();
+		bNativeActionStorageInUse = false;
+	}
+	CurrentNativeAction = nullptr;
+}
+
+void USussBrainComponent::DeferDestroyNativeActionStorage()
+{
+	// We may be inside the native action (e.g. its ActionCompleted), so destroy it once that has unwound
+	if (bNativeActionStorageInUse && GetWorld())
+	{
+		GetWorld()->GetTimerManager().SetTimerForNextTick(FTimerDelegate::CreateWeakLambda(this, [this]()
+		{
+			// Unless it's been replaced by a new native action in the meantime
+			if (!CurrentNativeAction)
+			{
+				DestroyNativeActionStorage();
+			}
+		}));
+	}
+}
+
+void USussBrainComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	DestroyNativeActionStorage();
+	FreeBrainState();
+	Super::EndPlay(EndPlayReason);
+}
+
+void USussBrainComponent::BeginDestroy()
+{
+	DestroyNativeActionStorage();
+	FreeBrainState();
+	Super::BeginDestroy();
 }
 
 void USussBrainComponent::RecordAndResetCurrentAction()
 {
-	auto& History = ActionHistory[CurrentActionResult.ActionDefIndex];
-	History.LastEndTime = GetWorld()->GetTimeSeconds();
+	const double Now = GetWorld()->GetTimeSeconds();
 	// Repetition penalties are CUMULATIVE
-	History.RepetitionPenalty += CombinedActionsByPriority[CurrentActionResult.ActionDefIndex].RepetitionPenalty;
-
-	// This will free automatically
-	CurrentActionInstance = nullptr;
+	GetBrainStates().EndCurrentAction(StateHandle,
+		GetActionDefs()[CurrentActionResult.ActionDefIndex].RepetitionPenalty,
+		Now);
+	LastEndTimeByTag[ActionTable->ActionTagIndexPerAction[CurrentActionResult.ActionDefIndex]] = Now;
+
+	// Frees back to the pool
+	CurrentActionInstance.Reset();
+	// Native action isn't destroyed here since this may be called from inside it (ActionCompleted), see
+	// DeferDestroyNativeActionStorage
+	CurrentNativeAction = nullptr;
 	CurrentActionResult.ActionDefIndex = -1;
 	CurrentActionResult.Score = 0;
 }
 
 bool USussBrainComponent::IsActionInProgress()
 {
-	return CurrentActionInstance != nullptr;
+	return CurrentActionInstance.IsValid() || CurrentNativeAction != nullptr;
 }
 
 void USussBrainComponent::ChooseAction(const FSussActionScoringResult& ActionResult)
 {
 	checkf(ActionResult.ActionDefIndex >= 0, TEXT("No supplied action def"));
 
-	const FSussActionDef& Def = CombinedActionsByPriority[ActionResult.ActionDefIndex];
+	const FSussActionDef& Def = GetActionDefs()[ActionResult.ActionDefIndex];
 	if (IsActionInProgress() && IsActionSameAsCurrent(ActionResult.ActionDefIndex, ActionResult.Context))
 	{
 		// We're already running it, so just continue
 		// However, update the score in case we've decided again
 		CurrentActionResult.Score = ActionResult.Score;
+		GetBrainStates().SetCurrentScore(StateHandle, ActionResult.Score, GetWorld()->GetTimeSeconds());
 #if ENABLE_VISUAL_LOG
 		UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("No Action Change, continue: %s %s"), Def.Description.IsEmpty() ? *Def.ActionTag.ToString() : *Def.Description, *ActionResult.Context.ToString());
 		ActionResult.Context.VisualLog(GetLogOwner());
 #endif
-		CurrentActionInstance->ContinueAction(ActionResult.Context, Def.ActionParams);
+		if (CurrentNativeAction)
+		{
+			CurrentNativeAction->ContinueAction(ActionResult.Context, Def.ActionParams);
+		}
+		else
+		{
+			CurrentActionInstance->ContinueAction(ActionResult.Context, Def.ActionParams);
+		}
 		return;
 	}
 
 	auto SUSS = GetSUSS(GetWorld());
-	const TSubclassOf<USussAction> ActionClass = SUSS->GetActionClass(Def.ActionTag);
+	const FSussNativeActionFactory* NativeFactory = SUSS->GetNativeActionFactory(Def.ActionTag);
+	const TSubclassOf<USussAction> ActionClass = NativeFactory ? nullptr : SUSS->GetActionClass(Def.ActionTag);
 
 #if ENABLE_VISUAL_LOG
 	UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("Chose NEW action: %s %s"), Def.Description.IsEmpty() ? *Def.ActionTag.ToString() : *Def.Description, *ActionResult.Context.ToString());
@@ -686,15 +925,31 @@ void USussBrainComponent::ChooseAction(const FSussActionScoringResult& ActionRes
 	CurrentActionResult = ActionResult;
 
 	// This is a new action, so we add inertia to the score now
-	CurrentActionResult.Score += Def.Inertia;
+	// Current score cools down at a rate determined by its last run score, or immediately if no cooldown
+	auto& States = GetBrainStates();
+	States.StartCurrentAction(StateHandle,
+		ActionResult.ActionDefIndex,
+		ActionResult.Score + Def.Inertia,
+		Def.ScoreCooldownTime > 0 ? ActionResult.Score / Def.ScoreCooldownTime : UE_BIG_NUMBER,
+		GetWorld()->GetTimeSeconds());
+
+	if (NativeFactory)
+	{
+		States.GetLastStartTimes(StateHandle)[ActionResult.ActionDefIndex] = GetWorld()->GetTimeSeconds();
+		States.GetLastRunScores(StateHandle)[ActionResult.ActionDefIndex] = ActionResult.Score;
 
-	if (ActionClass)
+		// Constructed in place, replacing any previous (completed) native action
+		DestroyNativeActionStorage();
+		CurrentNativeAction = NativeFactory->Construct(&NativeActionStorage);
+		bNativeActionStorageInUse = true;
+		CurrentNativeAction->Init(this, ActionResult.Context, ActionResult.ActionDefIndex, Def.ActionTag);
+		CurrentNativeAction->PerformAction(ActionResult.Context, Def.ActionParams, PreviousActionClass);
+	}
+	else if (ActionClass)
 	{
 		// Record the start of the action
-		auto& History = ActionHistory[ActionResult.ActionDefIndex];
-		History.LastStartTime = GetWorld()->GetTimeSeconds();
-		History.LastRunScore = ActionResult.Score;
-		History.LastContext = ActionResult.Context;
+		States.GetLastStartTimes(StateHandle)[ActionResult.ActionDefIndex] = GetWorld()->GetTimeSeconds();
+		States.GetLastRunScores(StateHandle)[ActionResult.ActionDefIndex] = ActionResult.Score;
 		
 		// Note that to allow BP classes we need to construct using the default object
 		CurrentActionInstance = GetSussPool(GetWorld())->ReserveAction(ActionClass, ActionClass->GetDefaultObject());
@@ -705,7 +960,8 @@ void USussBrainComponent::ChooseAction(const FSussActionScoringResult& ActionRes
 	else
 	{
 		// No action class provided for this tag, do nothing
-		CurrentActionInstance = nullptr;
+		CurrentActionInstance.Reset();
+		CurrentNativeAction = nullptr;
 
 		UE_LOG(LogSuss, Warning, TEXT("No action class for tag %s, so doing nothing"), *Def.ActionTag.ToString());
 		
@@ -732,9 +988,76 @@ void USussBrainComponent::OnActionCompleted(USussAction* SussAction)
 
 }
 
+void USussBrainComponent::OnNativeActionCompleted(FSussNativeAction* NativeAction)
+{
+	// Same as OnActionCompleted, ignore late completions of actions we've already abandoned
+	if (CurrentNativeAction && CurrentNativeAction == NativeAction)
+	{
+#if ENABLE_VISUAL_LOG
+		UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("Action completed: %s"), *NativeAction->GetActionTag().ToString());
+#endif
+
+		RecordAndResetCurrentAction();
+		DeferDestroyNativeActionStorage();
+		QueueForUpdate();
+	}
+}
+
+float USussBrainComponent::GetTimeUntilNextUpdateRequest() const
+{
+	if (UpdateRequestTimer.IsValid())
+	{
+		return GetWorld()->GetTimerManager().GetTimerRemaining(UpdateRequestTimer);
+	}
+	return -1;
+}
+
+void USussBrainComponent::PrefetchQueries(float LookaheadSeconds)
+{
+	bQueriesPrefetched = true;
+
+	if (bIsLogicStopped || !GetOwner()->HasAuthority())
+		return;
+
+	// Update won't evaluate anything in this case, no point warming caches
+	if (!CanCurrentActionBeInterrupted())
+		return;
+
+	AActor* Self = GetSelf();
+
+	for (int i = 0; i < GetActionDefs().Num(); ++i)
+	{
+		const FSussActionDef& Action = GetActionDefs()[i];
+		// Same filtering as Update; tag requirements aren't checked since they may well change before then
+		if (Action.Weight < UE_KINDA_SMALL_NUMBER || !ActionTable->ActionEnabled[i])
+			continue;
+
+		for (const auto& Compiled : GetCompiledActions()[i].Queries)
+		{
+			// Correlated queries depend on other results & are never cached
+			if (Compiled.Provider->IsCorrelatedWithContext())
+				continue;
+
+			const FSussQuery& Query = *Compiled.Query;
+			if (Compiled.bHasAutoParameters)
+			{
+				FSussUpdateArenaMark ArenaMark;
+				TMap<FName, FSussParameter>& ResolvedParams = FSussUpdateArena::Get().AcquireMap<FName, FSussParameter>();
+				ResolveParameters(Self, Query.Params, ResolvedParams);
+				Compiled.Provider->PrefetchResults(this, Self, Query.MaxFrequency, LookaheadSeconds, ResolvedParams);
+			}
+			else
+			{
+				Compiled.Provider->PrefetchResults(this, Self, Query.MaxFrequency, LookaheadSeconds, Query.Params);
+			}
+		}
+	}
+}
+
 void USussBrainComponent::Update()
 {
 	bQueuedForUpdate = false;
+	bQueriesPrefetched = false;
 	
 	if (!GetOwner()->HasAuthority())
 		return;
@@ -745,11 +1068,11 @@ void USussBrainComponent::Update()
 	if (bIsLogicStopped)
 		return;
 
-	if (CombinedActionsByPriority.IsEmpty())
+	if (GetActionDefs().IsEmpty())
 		return;
 
 	/// If we can't be interrupted, no need to check what else we could be doing
-	if (CurrentActionInstance.IsValid() && !CurrentActionInstance->CanBeInterrupted())
+	if (!CanCurrentActionBeInterrupted())
 		return;
 
 #if ENABLE_VISUAL_LOG
@@ -757,20 +1080,31 @@ void USussBrainComponent::Update()
 #endif
 
 	auto SUSS = GetSUSS(GetWorld());
-	auto Pool = GetSussPool(GetWorld());
 	AActor* Self = GetSelf();
 
-	const FSussActionDef* CurrentActionDef = IsActionInProgress() ? &CombinedActionsByPriority[CurrentActionResult.ActionDefIndex] : nullptr;
+	// Transient containers acquired anywhere during the update are all given back at the end of it
+	FSussUpdateArenaMark ArenaMark;
+
+	const FSussActionDef* CurrentActionDef = IsActionInProgress() ? &GetActionDefs()[CurrentActionResult.ActionDefIndex] : nullptr;
+
+	PruneCachedInputValues();
+	ResetResolvedAutoParams();
+	const FSussContext SelfContext { Self };
+	UpdateOwnedActionGatingTags();
 	
-	int CurrentPriority = CombinedActionsByPriority[0].Priority;
+	int CurrentPriority = GetActionDefs()[0].Priority;
 	// Use reset not empty in order to keep memory stable
 	CandidateActions.Reset();
 	bool bAddedCurrentAction = false;
-	for (int i = 0; i < CombinedActionsByPriority.Num(); ++i)
+	// Cooled down values are evaluated as of now
+	const auto& States = GetBrainStates();
+	const double Now = GetWorld()->GetTimeSeconds();
+	const float CurrentScore = States.GetCurrentScore(StateHandle, Now);
+	for (int i = 0; i < GetActionDefs().Num(); ++i)
 	{
-		const FSussActionDef& NextAction = CombinedActionsByPriority[i];
+		const FSussActionDef& NextAction = GetActionDefs()[i];
 
-		if (CurrentActionInstance.IsValid() && CurrentActionInstance->AllowInterruptionsFromHigherPriorityGroupsOnly() && CurrentActionDef->Priority <= NextAction.Priority)
+		if (CurrentActionDef && CurrentActionAllowsInterruptionsFromHigherPriorityGroupsOnly() && CurrentActionDef->Priority <= NextAction.Priority)
 		{
 			// Don't consider anything else of equal or lower priority
 			break;
@@ -795,20 +1129,17 @@ void USussBrainComponent::Update()
 			continue;
 
 		// Ignore bad config or globally disabled actions
-		if (!NextAction.ActionTag.IsValid() || !USussUtility::IsActionEnabled(NextAction.ActionTag))
+		if (!ActionTable->ActionEnabled[i])
 			continue;
 
 		// Check required/blocking tags on self
-		if (NextAction.RequiredTags.Num() > 0 && !USussUtility::ActorHasAllTags(GetOwner(), NextAction.RequiredTags))
+		const FSussCompiledAction& CompiledAction = GetCompiledActions()[i];
+		if (CompiledAction.bHasRequiredTags && !CompiledAction.RequiredTagBits.IsSubsetOf(OwnedGatingTags))
 			continue;
-		if (NextAction.BlockingTags.Num() > 0 && USussUtility::ActorHasAnyTags(GetOwner(), NextAction.BlockingTags))
+		if (CompiledAction.bHasBlockingTags && CompiledAction.BlockingTagBits.Intersects(OwnedGatingTags))
 			continue;
 
-		auto ArrayPool = GetSussPool(GetWorld());
-		
-		FSussScopeReservedArray ContextsScope = ArrayPool->ReserveArray<FSussContext>();
-		TArray<FSussContext>& Contexts = *ContextsScope.Get<FSussContext>();
-		GenerateContexts(Self, NextAction, Contexts);
+		const TArray<FSussContext>& Contexts = GetOrGenerateContexts(Self, i);
 
 #if ENABLE_VISUAL_LOG
 		UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("Action: %s  Priority: %d Weight: %4.2f Contexts: %d"),
@@ -818,56 +1149,97 @@ void USussBrainComponent::Update()
 			Contexts.Num());
 #endif
 		
-		// Evaluate this action for every applicable context
-		for (const auto& Ctx : Contexts)
+		// Evaluate this action for every applicable context, one consideration at a time so that curves can be
+		// evaluated for all contexts in one batch
+		const int NumContexts = Contexts.Num();
+		ContextScoresScratch.Init(NextAction.Weight, NumContexts);
+		LiveContextsScratch.Reset();
+		for (int c = 0; c < NumContexts; ++c)
 		{
+			LiveContextsScratch.Add(c);
+		}
+		// Contexts which have hit a zero score are dropped from the end of this range, nothing can change them now
+		int NumLive = NumContexts;
+		
+		for (const auto& Compiled : CompiledAction.Considerations)
+		{
+			if (NumLive == 0)
+				break;
+			
+			const FSussConsideration& Consideration = *Compiled.Consideration;
+
+			// Parameters are resolved against Self only, so the same for every context
+			const TMap<FName, FSussParameter>* Params = &Consideration.Parameters;
+			if (Compiled.bHasAutoParameters)
+			{
+				ResolvedParamsScratch.Reset();
+				ResolveParameters(Self, Consideration.Parameters, ResolvedParamsScratch);
+				Params = &ResolvedParamsScratch;
+			}
+
+			// Evaluate inputs for all live contexts in one go
+			LiveContextPtrsScratch.Reset();
+			for (int l = 0; l < NumLive; ++l)
+			{
+				LiveContextPtrsScratch.Add(&Contexts[LiveContextsScratch[l]]);
+			}
+			InputValuesScratch.Reset();
+			InputValuesScratch.AddUninitialized(NumLive);
+			EvaluateInputs(Compiled.InputProvider, LiveContextPtrsScratch, *Params, InputValuesScratch);
+
+			// Normalise to bookends and clamp
+			NormalisedInputsScratch.Reset();
+			for (int l = 0; l < NumLive; ++l)
+			{
+				const FSussContext& Ctx = *LiveContextPtrsScratch[l];
+				const float RawInputValue = InputValuesScratch[l];
+				const float BookendMin = Compiled.bLiteralBookends ? Compiled.BookendMin : ResolveParameter(Ctx, Consideration.BookendMin).FloatValue;
+				const float BookendMax = Compiled.bLiteralBookends ? Compiled.BookendMax : ResolveParameter(Ctx, Consideration.BookendMax).FloatValue;
+				NormalisedInputsScratch.Add(FMath::Clamp(FMath::GetRangePct(BookendMin, BookendMax, RawInputValue), 0.f, 1.f));
+			}
+
+			// Transform through curve
+			CurveScoresScratch.Reset();
+			CurveScoresScratch.AddUninitialized(NumLive);
+			if (Compiled.CurveLUT.IsValid())
+			{
+				Compiled.CurveLUT->EvaluateBatch(NormalisedInputsScratch, CurveScoresScratch);
+			}
+			else
+			{
+				Consideration.EvaluateCurveBatch(NormalisedInputsScratch, CurveScoresScratch);
+			}
+
+			// Accumulate with overall scores
+			int NumStillLive = 0;
+			for (int l = 0; l < NumLive; ++l)
+			{
+				const int ContextIndex = LiveContextsScratch[l];
+				float& Score = ContextScoresScratch[ContextIndex];
+				Score *= CurveScoresScratch[l];
+
 #if ENABLE_VISUAL_LOG
-			UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT(" - %s"), *Ctx.ToString());
-#endif
-			float Score = NextAction.Weight;
-			for (const auto& Consideration : NextAction.Considerations)
-			{
-				if (const auto InputProvider = SUSS->GetInputProvider(Consideration.InputTag))
-				{
-					// Resolve parameters
-					FSussScopeReservedMap ResolvedQueryParamsScope = Pool->ReserveMap<FName, FSussParameter>();
-					TMap<FName, FSussParameter>& ResolvedParams = *ResolvedQueryParamsScope.Get<FName, FSussParameter>();
-					ResolveParameters(Self, Consideration.Parameters, ResolvedParams);
-
-					const float RawInputValue = InputProvider->Evaluate(this, Ctx, ResolvedParams);
-
-					// Normalise to bookends and clamp
-					const float NormalisedInput = FMath::Clamp(FMath::GetRangePct(
-						                                           ResolveParameter(
-							                                           Ctx,
-							                                           Consideration.BookendMin).FloatValue,
-						                                           ResolveParameter(
-							                                           Ctx,
-							                                           Consideration.BookendMax).FloatValue,
-						                                           RawInputValue),
-					                                           0.f,
-					                                           1.f);
-
-					// Transform through curve
-					const float ConScore = Consideration.EvaluateCurve(NormalisedInput);
-
-#if ENABLE_VISUAL_LOG
-					UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("  * Consideration: %s  Input: %4.2f  Normalised: %4.2f  Final: %4.2f"),
-						Consideration.Description.IsEmpty() ? *Consideration.InputTag.ToString() : *Consideration.Description,
-						RawInputValue, NormalisedInput, ConScore);
+				UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("  * Consideration: %s  Context: %s  Normalised: %4.2f  Final: %4.2f"),
+					Consideration.Description.IsEmpty() ? *Consideration.InputTag.ToString() : *Consideration.Description,
+					*Contexts[ContextIndex].ToString(), NormalisedInputsScratch[l], CurveScoresScratch[l]);
 #endif
 
-					// Accumulate with overall score
-					Score *= ConScore;
-
-					// Early-out if we've ended up at zero, nothing can change this now
-					if (FMath::IsNearlyZero(Score))
-					{
-						break;
-					}
-					
+				// Early-out if we've ended up at zero, nothing can change this now
+				if (!FMath::IsNearlyZero(Score))
+				{
+					LiveContextsScratch[NumStillLive++] = ContextIndex;
 				}
 			}
+			NumLive = NumStillLive;
+		}
+
+		for (int c = 0; c < NumContexts; ++c)
+		{
+			const FSussContext& Ctx = Contexts[c];
+			float Score = ContextScoresScratch[c];
+#if ENABLE_VISUAL_LOG
+			UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT(" - %s"), *Ctx.ToString());
+#endif
 			
 			const bool bIsCurrentAction = IsActionSameAsCurrent(i, Ctx);			
 			if (bIsCurrentAction)
@@ -875,30 +1247,31 @@ void USussBrainComponent::Update()
 				// We preserve the previous score if better, which bleeds away over time
 				// This is so that if an action is decided on with a given score (plus inertia), even if it's not in the
 				// running anymore, we won't interrupt it without a much better option
-				if (CurrentActionResult.Score > Score)
+				if (CurrentScore > Score)
 				{
 #if ENABLE_VISUAL_LOG
-					UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("  * Current Action Score upgrade from %4.2f to %4.2f"), Score, CurrentActionResult.Score);
+					UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("  * Current Action Score upgrade from %4.2f to %4.2f"), Score, CurrentScore);
 #endif
-					Score = CurrentActionResult.Score;
+					Score = CurrentScore;
 				}
 			}
 
-			const auto& Hist = ActionHistory[i];
 			// Add repetition penalty if applicable
 			if (ShouldSubtractRepetitionPenaltyToProposedAction(i, Ctx))
 			{
-				Score -= Hist.RepetitionPenalty;
+				const float RepetitionPenalty = States.GetRepetitionPenalty(StateHandle, i, Now);
+				Score -= RepetitionPenalty;
 #if ENABLE_VISUAL_LOG
-				UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("  * Repetition Penalty: -%4.2f"), Hist.RepetitionPenalty);
+				UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("  * Repetition Penalty: -%4.2f"), RepetitionPenalty);
 #endif
 			}
-			if (!FMath::IsNearlyZero(Hist.TempScoreAdjust))
+			const float TempScoreAdjust = States.GetTempScoreAdjust(StateHandle, i, Now);
+			if (!FMath::IsNearlyZero(TempScoreAdjust))
 			{
 				// Add temp adjustments
-				Score += Hist.TempScoreAdjust;
+				Score += TempScoreAdjust;
 #if ENABLE_VISUAL_LOG
-				UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("  * Temp Adjust: %4.2f"), Hist.TempScoreAdjust);
+				UE_VLOG(GetLogOwner(), LogSuss, Log, TEXT("  * Temp Adjust: %4.2f"), TempScoreAdjust);
 #endif
 				
 			}
@@ -909,7 +1282,7 @@ void USussBrainComponent::Update()
 
 			if (!FMath::IsNearlyZero(Score))
 			{
-				CandidateActions.Add(FSussActionScoringResult { i, Ctx, Score });
+				CandidateActions.Add(FSussActionCandidate { i, c, Score });
 				if (bIsCurrentAction)
 				{
 					bAddedCurrentAction = true;
@@ -919,12 +1292,12 @@ void USussBrainComponent::Update()
 		
 	}
 
-	if (!bAddedCurrentAction && IsActionInProgress() && CurrentActionResult.Score > 0)
+	if (!bAddedCurrentAction && IsActionInProgress() && CurrentScore > 0)
 	{
 		// If the current action wasn't added because it wasn't scoring > 0 right now, we should still add back
 		// the current action with its current score. This is to avoid cases where an action changes the state which
 		// made it valid in the first place, but it still has an ongoing task to do (but is interruptible as well)
-		CandidateActions.Add(CurrentActionResult);
+		CandidateActions.Add(FSussActionCandidate { CurrentActionResult.ActionDefIndex, INDEX_NONE, CurrentScore });
 	}
 
 	ChooseActionFromCandidates();
@@ -955,104 +1328,235 @@ const UObject* USussBrainComponent::GetLogOwner() const
 }
 
 FSussParameter USussBrainComponent::ResolveParameter(const FSussContext& SelfContext, const FSussParameter& Value) const
+{
+	// Literals need no resolving
+	if (Value.Type != ESussParamType::AutoParameter)
+		return Value;
+
+	// Only resolutions against Self alone are the same for the whole update; anything resolved against a full
+	// context (e.g. bookends) depends on that context's target / location / values so can't be shared
+	const bool bSelfOnly = SelfContext.Target.IsExplicitlyNull() &&
+		SelfContext.Location.IsZero() &&
+		SelfContext.NamedValues.Num() == 0;
+	if (!bSelfOnly)
+	{
+		return ResolveAutoParameter(SelfContext, Value);
+	}
+
+	// Memo is only valid for one Self & one update (or frame, when resolving outside of an update)
+	if (ResolvedAutoParamsMemoFrame != GFrameCounter || ResolvedAutoParamsMemoSelf.Get() != SelfContext.ControlledActor)
+	{
+		ResetResolvedAutoParams();
+		ResolvedAutoParamsMemoSelf = SelfContext.ControlledActor;
+	}
+
+	if (const FSussParameter* pResolved = ResolvedAutoParamsMemo.Find(Value.InputOrParameterTag))
+	{
+		return *pResolved;
+	}
+
+	return ResolvedAutoParamsMemo.Add(Value.InputOrParameterTag, ResolveAutoParameter(SelfContext, Value));
+}
+
+void USussBrainComponent::ResetResolvedAutoParams() const
+{
+	ResolvedAutoParamsMemo.Reset();
+	ResolvedAutoParamsMemoFrame = GFrameCounter;
+}
+
+FSussParameter USussBrainComponent::ResolveAutoParameter(const FSussContext& SelfContext, const FSussParameter& Value) const
 {
 	static TMap<FName, FSussParameter> DummyParams;
 
-	if (Value.Type == ESussParamType::AutoParameter)
+	auto SUSS = GetSUSS(GetWorld());
+	if (Value.InputOrParameterTag.MatchesTag(TAG_SussInputParentTag))
 	{
-		auto SUSS = GetSUSS(GetWorld());
-		if (Value.InputOrParameterTag.MatchesTag(TAG_SussInputParentTag))
+		// Inputs always resolve to float
+		if (auto InputProvider = SUSS->GetInputProvider(Value.InputOrParameterTag))
 		{
-			// Inputs always resolve to float
-			if (auto InputProvider = SUSS->GetInputProvider(Value.InputOrParameterTag))
-			{
-				return InputProvider->Evaluate(this, SelfContext, DummyParams);
-			}
+			return InputProvider->Evaluate(this, SelfContext, DummyParams);
 		}
-		else if (Value.InputOrParameterTag.MatchesTag(TAG_SussParamParentTag))
+	}
+	else if (Value.InputOrParameterTag.MatchesTag(TAG_SussParamParentTag))
+	{
+		// Other auto params can return any value
+		if (auto ParamProvider = SUSS->GetParameterProvider(Value.InputOrParameterTag))
 		{
-			// Other auto params can return any value
-			if (auto ParamProvider = SUSS->GetParameterProvider(Value.InputOrParameterTag))
-			{
-				return ParamProvider->Evaluate(this, SelfContext, DummyParams);
-			}
+			return ParamProvider->Evaluate(this, SelfContext, DummyParams);
 		}
 	}
 	// Fallback
 	return Value;
 }
 
-void USussBrainComponent::GenerateContexts(AActor* Self, const FSussActionDef& Action, TArray<FSussContext>& OutContexts)
+bool USussBrainComponent::HasAutoParameters(const TMap<FName, FSussParameter>& Params)
+{
+	for (const auto& Pair : Params)
+	{
+		if (Pair.Value.Type == ESussParamType::AutoParameter)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void USussBrainComponent::CompileAction(const FSussActionDef& Action, FSussCompiledAction& OutCompiled) const
 {
 	auto SUSS = GetSUSS(GetWorld());
 
-	auto Pool = GetSussPool(GetWorld());
+	CompileQueries(Action, OutCompiled.Queries);
 
-	if (Action.Queries.Num() > 0)
+	OutCompiled.Considerations.Reset();
+	for (const auto& Consideration : Action.Considerations)
 	{
-		TSet<ESussQueryContextElement> ContextElements;
-		TSet<FName> NamedQueryValues;
+		// Missing inputs resolve to the default provider, so this only fails if the subsystem is missing
+		auto InputProvider = SUSS ? SUSS->GetInputProvider(Consideration.InputTag) : nullptr;
+		if (!InputProvider)
+			continue;
 
-		for (const auto& Query : Action.Queries)
+		FSussCompiledConsideration& Compiled = OutCompiled.Considerations.AddDefaulted_GetRef();
+		Compiled.Consideration = &Consideration;
+		Compiled.InputProvider = InputProvider;
+		Compiled.bHasAutoParameters = HasAutoParameters(Consideration.Parameters);
+		Compiled.bLiteralBookends = Consideration.BookendMin.Type != ESussParamType::AutoParameter &&
+			Consideration.BookendMax.Type != ESussParamType::AutoParameter;
+		if (Compiled.bLiteralBookends)
 		{
-			auto QueryProvider = SUSS->GetQueryProvider(Query.QueryTag);
-			if (!QueryProvider)
-				continue;
+			Compiled.BookendMin = Consideration.BookendMin.FloatValue;
+			Compiled.BookendMax = Consideration.BookendMax.FloatValue;
+		}
+		if (SUSS && Consideration.CurveType == ESussCurveType::Custom && Consideration.CustomCurveResolution > 0)
+		{
+			Compiled.CurveLUT = SUSS->GetCurveLUT(Consideration.CustomCurve, Consideration.CustomCurveResolution);
+		}
+	}
+}
 
-			FSussScopeReservedMap ResolvedQueryParamsScope = Pool->ReserveMap<FName, FSussParameter>();
-			TMap<FName, FSussParameter>& ResolvedParams = *ResolvedQueryParamsScope.Get<FName, FSussParameter>();
-			ResolveParameters(Self, Query.Params, ResolvedParams);
+void USussBrainComponent::CompileQueries(const FSussActionDef& Action, TArray<FSussCompiledQuery>& OutQueries) const
+{
+	auto SUSS = GetSUSS(GetWorld());
 
-			// Because we use the results from each query to multiply combinations with existing results, we cannot have >1 query
-			// returning the same element (you'd multiply Targets * Targets for example)
-			const auto Element = QueryProvider->GetProvidedContextElement();
-			// Special case for Named Values, we can have multiples, just not providing the same name
-			if (Element != ESussQueryContextElement::NamedValue && ContextElements.Contains(Element))
-			{
-				UE_LOG(LogSuss,
-				       Warning,
-				       TEXT("Action %s has more than one query returning %s, ignoring extra one %s"),
-				       *Action.ActionTag.ToString(),
-				       *StaticEnum<ESussQueryContextElement>()->GetValueAsString(Element),
-				       *Query.QueryTag.ToString())
-				continue;
-			}
-			ContextElements.Add(Element);
+	OutQueries.Reset();
+	if (!SUSS)
+		return;
+
+	TSet<ESussQueryContextElement> ContextElements;
+	TSet<FName> NamedQueryValues;
+
+	for (const auto& Query : Action.Queries)
+	{
+		auto QueryProvider = SUSS->GetQueryProvider(Query.QueryTag);
+		if (!QueryProvider)
+			continue;
+
+		// Because we use the results from each query to multiply combinations with existing results, we cannot have >1 query
+		// returning the same element (you'd multiply Targets * Targets for example)
+		const auto Element = QueryProvider->GetProvidedContextElement();
+		// Special case for Named Values, we can have multiples, just not providing the same name
+		if (Element != ESussQueryContextElement::NamedValue && ContextElements.Contains(Element))
+		{
+			UE_LOG(LogSuss,
+			       Warning,
+			       TEXT("Action %s has more than one query returning %s, ignoring extra one %s"),
+			       *Action.ActionTag.ToString(),
+			       *StaticEnum<ESussQueryContextElement>()->GetValueAsString(Element),
+			       *Query.QueryTag.ToString())
+			continue;
+		}
+		ContextElements.Add(Element);
 
-			if (Element == ESussQueryContextElement::NamedValue)
+		if (Element == ESussQueryContextElement::NamedValue)
+		{
+			if (auto NQP = Cast<USussNamedValueQueryProvider>(QueryProvider))
 			{
-				if (auto NQP = Cast<USussNamedValueQueryProvider>(QueryProvider))
+				const FName ValueName = NQP->GetQueryValueName();
+				// Make sure we haven't seen this name before; since we allow multiple named type queries
+				if (NamedQueryValues.Contains(ValueName))
 				{
-					const FName ValueName = NQP->GetQueryValueName();
-					// Make sure we haven't seen this name before; since we allow multiple named type queries
-					if (NamedQueryValues.Contains(ValueName))
-					{
-						UE_LOG(LogSuss,
-							   Warning,
-							   TEXT("Action %s has more than one query returning named value %s, ignoring extra one %s"),
-							   *Action.ActionTag.ToString(),
-							   *ValueName.ToString(),
-							   *Query.QueryTag.ToString());
-						continue;
-					}
-					NamedQueryValues.Add(ValueName);
+					UE_LOG(LogSuss,
+						   Warning,
+						   TEXT("Action %s has more than one query returning named value %s, ignoring extra one %s"),
+						   *Action.ActionTag.ToString(),
+						   *ValueName.ToString(),
+						   *Query.QueryTag.ToString());
+					continue;
 				}
+				NamedQueryValues.Add(ValueName);
 			}
+		}
+
+		OutQueries.Add(FSussCompiledQuery { &Query, QueryProvider, HasAutoParameters(Query.Params) });
+	}
+}
 
-			if (QueryProvider->IsCorrelatedWithContext())
+void USussBrainComponent::GenerateContexts(AActor* Self, const FSussActionDef& Action, TArray<FSussContext>& OutContexts)
+{
+	// Compile on the fly; Update uses the pre-compiled version
+	TArray<FSussCompiledQuery> Queries;
+	CompileQueries(Action, Queries);
+	GenerateContexts(Self, Action, Queries, OutContexts);
+}
+
+void USussBrainComponent::GenerateContexts(AActor* Self,
+                                           const FSussActionDef& Action,
+                                           const TArray<FSussCompiledQuery>& Queries,
+                                           TArray<FSussContext>& OutContexts)
+{
+	GenerateContexts(Self, Action, Queries, false, OutContexts);
+}
+
+void USussBrainComponent::GenerateContexts(AActor* Self,
+                                           const FSussActionDef& Action,
+                                           const TArray<FSussCompiledQuery>& Queries,
+                                           bool bResultsFetched,
+                                           TArray<FSussContext>& OutContexts)
+{
+	// Check the original queries, not the compiled ones; if all queries were invalid we get no contexts, not just Self
+	if (Action.Queries.Num() > 0)
+	{
+		QueryResultsScratch.SetNum(Queries.Num());
+
+		// Returns false if the query generated no results
+		auto RunQuery = [&](int QueryIndex, const TMap<FName, FSussParameter>& Params)
+		{
+			const FSussCompiledQuery& Compiled = Queries[QueryIndex];
+			if (Compiled.Provider->IsCorrelatedWithContext())
+			{
+				IntersectCorrelatedContexts(Self, *Compiled.Query, Compiled.Provider, Params, OutContexts);
+				return true;
+			}
+			FetchUncorrelatedResults(Self, Compiled, Params, QueryResultsScratch[QueryIndex]);
+			return AppendUncorrelatedContexts(Self, Compiled.Provider, QueryResultsScratch[QueryIndex], OutContexts);
+		};
+		
+		for (int q = 0; q < Queries.Num(); ++q)
+		{
+			const FSussCompiledQuery& Compiled = Queries[q];
+			bool bAnyResults;
+			if (bResultsFetched)
+			{
+				bAnyResults = AppendUncorrelatedContexts(Self, Compiled.Provider, QueryResultsScratch[q], OutContexts);
+			}
+			else if (Compiled.bHasAutoParameters)
 			{
-				IntersectCorrelatedContexts(Self, Query, QueryProvider, ResolvedParams, OutContexts);
+				FSussUpdateArenaMark ArenaMark;
+				TMap<FName, FSussParameter>& ResolvedParams = FSussUpdateArena::Get().AcquireMap<FName, FSussParameter>();
+				ResolveParameters(Self, Compiled.Query->Params, ResolvedParams);
+				bAnyResults = RunQuery(q, ResolvedParams);
 			}
 			else
 			{
-				if (!AppendUncorrelatedContexts(Self, Query, QueryProvider, ResolvedParams, OutContexts))
-				{
-					// This query generated no results, therefore instead of NxM it's Nx0 == no results at all
-					OutContexts.Empty();
-					return;
-				}
+				// All literal, pass straight through
+				bAnyResults = RunQuery(q, Compiled.Query->Params);
+			}
+
+			if (!bAnyResults)
+			{
+				// This query generated no results, therefore instead of NxM it's Nx0 == no results at all
+				OutContexts.Empty();
+				return;
 			}
-			
 		}
 	}
 	else
@@ -1063,6 +1567,203 @@ void USussBrainComponent::GenerateContexts(AActor* Self, const FSussActionDef& A
 	
 }
 
+void USussBrainComponent::EvaluateInputs(const USussInputProvider* InputProvider,
+	TConstArrayView<const FSussContext*> Contexts,
+	const TMap<FName, FSussParameter>& Params,
+	TArrayView<float> OutValues)
+{
+	if (!InputProvider->IsCachingValues())
+	{
+		InputProvider->EvaluateBatchMemoised(this, Contexts, Params, OutValues);
+		return;
+	}
+
+	const double Now = GetWorld()->GetTimeSeconds();
+	const uint32 Generation = InputProvider->GetCacheGeneration();
+	FSussCachedInputValues& Cache = FindOrAddCachedInputValues(InputProvider, Params);
+
+	InputCacheMissContexts.Reset();
+	InputCacheMissIndices.Reset();
+	InputCacheMissKeys.Reset();
+	for (int i = 0; i < Contexts.Num(); ++i)
+	{
+		const FSussInputContextKey Key = InputProvider->MakeCacheKey(*Contexts[i]);
+		const FSussCachedInputValue* pCached = Cache.Values.Find(Key);
+		if (pCached && pCached->Generation == Generation && Now < pCached->ExpiryTime)
+		{
+			OutValues[i] = pCached->Value;
+		}
+		else
+		{
+			InputCacheMissContexts.Add(Contexts[i]);
+			InputCacheMissIndices.Add(i);
+			InputCacheMissKeys.Add(Key);
+		}
+	}
+	InputProvider->RecordCacheLookups(Contexts.Num() - InputCacheMissContexts.Num(), InputCacheMissContexts.Num());
+
+	if (InputCacheMissContexts.IsEmpty())
+		return;
+
+	InputCacheMissValues.Reset();
+	InputCacheMissValues.AddUninitialized(InputCacheMissContexts.Num());
+	InputProvider->EvaluateBatchMemoised(this, InputCacheMissContexts, Params, InputCacheMissValues);
+
+	const double ExpiryTime = InputProvider->GetCacheTimeToLive() > 0 ? Now + InputProvider->GetCacheTimeToLive() : UE_DOUBLE_BIG_NUMBER;
+	for (int m = 0; m < InputCacheMissContexts.Num(); ++m)
+	{
+		OutValues[InputCacheMissIndices[m]] = InputCacheMissValues[m];
+		Cache.Values.Add(InputCacheMissKeys[m], FSussCachedInputValue { InputCacheMissValues[m], ExpiryTime, Generation });
+	}
+}
+
+FSussCachedInputValues& USussBrainComponent::FindOrAddCachedInputValues(const USussInputProvider* InputProvider,
+	const TMap<FName, FSussParameter>& Params)
+{
+	// Parameters are compared in full, the hash just makes most mismatches quick
+	const uint32 ParamsHash = USussInputProvider::HashParameters(Params);
+	for (auto& Cache : CachedInputValues)
+	{
+		if (Cache.Provider == InputProvider &&
+			Cache.ParamsHash == ParamsHash &&
+			USussInputProvider::ParametersMatch(Cache.Parameters, Params))
+		{
+			return Cache;
+		}
+	}
+
+	FSussCachedInputValues& Cache = CachedInputValues.AddDefaulted_GetRef();
+	Cache.Provider = InputProvider;
+	Cache.ParamsHash = ParamsHash;
+	Cache.Parameters = Params;
+	return Cache;
+}
+
+void USussBrainComponent::PruneCachedInputValues()
+{
+	// Values keyed on targets / locations accumulate over time, so periodically throw away those which can't be used
+	constexpr double PruneInterval = 5;
+	const double Now = GetWorld()->GetTimeSeconds();
+	if (Now < NextInputCachePruneTime)
+		return;
+
+	NextInputCachePruneTime = Now + PruneInterval;
+	for (int c = CachedInputValues.Num() - 1; c >= 0; --c)
+	{
+		FSussCachedInputValues& Cache = CachedInputValues[c];
+		const uint32 Generation = Cache.Provider->GetCacheGeneration();
+		for (auto It = Cache.Values.CreateIterator(); It; ++It)
+		{
+			if (Now >= It->Value.ExpiryTime || It->Value.Generation != Generation)
+			{
+				It.RemoveCurrent();
+			}
+		}
+		if (Cache.Values.Num() == 0)
+		{
+			CachedInputValues.RemoveAtSwap(c);
+		}
+	}
+}
+
+const TArray<FSussContext>& USussBrainComponent::GetOrGenerateContexts(AActor* Self, int ActionIndex)
+{
+	const FSussActionDef& Action = GetActionDefs()[ActionIndex];
+	FSussCachedActionContexts& Cached = CachedActionContexts[ActionIndex];
+
+	// Results are fetched along with their versions, so if anything has changed the contexts are generated from
+	// exactly the results the versions describe, without asking the queries again
+	const FSussCompiledAction& Compiled = GetCompiledActions()[ActionIndex];
+	const bool bVersioned = FetchVersionedQueryResults(Self, Compiled.Queries, QueryVersionsScratch);
+	if (bVersioned &&
+		Cached.bValid &&
+		Cached.Self.Get() == Self &&
+		Cached.QueryVersions == QueryVersionsScratch)
+	{
+		// Nothing has changed since we generated these
+		return Cached.Contexts;
+	}
+
+	Cached.Contexts.Reset();
+	GenerateContexts(Self, Action, Compiled.Queries, bVersioned, Cached.Contexts);
+	Cached.Self = Self;
+	Cached.QueryVersions = QueryVersionsScratch;
+	Cached.bValid = bVersioned;
+
+	return Cached.Contexts;
+}
+
+bool USussBrainComponent::FetchVersionedQueryResults(AActor* Self,
+	const TArray<FSussCompiledQuery>& Queries,
+	TArray<TSussQueryResultVersion>& OutVersions)
+{
+	OutVersions.Reset();
+	// Check first so that nothing is run here which GenerateContexts would then run again
+	for (const auto& Compiled : Queries)
+	{
+		if (!Compiled.Provider->HasVersionedResults())
+			return false;
+	}
+
+	QueryResultsScratch.SetNum(Queries.Num());
+	for (int q = 0; q < Queries.Num(); ++q)
+	{
+		const FSussCompiledQuery& Compiled = Queries[q];
+		uint32 Version;
+		if (Compiled.bHasAutoParameters)
+		{
+			FSussUpdateArenaMark ArenaMark;
+			TMap<FName, FSussParameter>& ResolvedParams = FSussUpdateArena::Get().AcquireMap<FName, FSussParameter>();
+			ResolveParameters(Self, Compiled.Query->Params, ResolvedParams);
+			Version = FetchUncorrelatedResults(Self, Compiled, ResolvedParams, QueryResultsScratch[q]);
+		}
+		else
+		{
+			Version = FetchUncorrelatedResults(Self, Compiled, Compiled.Query->Params, QueryResultsScratch[q]);
+		}
+		OutVersions.Add(TSussQueryResultVersion(Compiled.Provider, Version));
+	}
+	return true;
+}
+
+bool USussBrainComponent::GetQueryResultVersions(AActor* Self,
+                                                 const FSussActionDef& Action,
+                                                 TArray<TSussQueryResultVersion>& OutVersions)
+{
+	TArray<FSussCompiledQuery> Queries;
+	CompileQueries(Action, Queries);
+	return GetQueryResultVersions(Self, Queries, OutVersions);
+}
+
+bool USussBrainComponent::GetQueryResultVersions(AActor* Self,
+                                                 const TArray<FSussCompiledQuery>& Queries,
+                                                 TArray<TSussQueryResultVersion>& OutVersions)
+{
+	OutVersions.Reset();
+	for (const auto& Compiled : Queries)
+	{
+		if (!Compiled.Provider->HasVersionedResults())
+			return false;
+
+		const FSussQuery& Query = *Compiled.Query;
+		uint32 Version;
+		if (Compiled.bHasAutoParameters)
+		{
+			FSussUpdateArenaMark ArenaMark;
+			TMap<FName, FSussParameter>& ResolvedParams = FSussUpdateArena::Get().AcquireMap<FName, FSussParameter>();
+			ResolveParameters(Self, Query.Params, ResolvedParams);
+			Version = Compiled.Provider->GetResultsVersion(this, Self, Query.MaxFrequency, ResolvedParams);
+		}
+		else
+		{
+			Version = Compiled.Provider->GetResultsVersion(this, Self, Query.MaxFrequency, Query.Params);
+		}
+
+		OutVersions.Add(TSussQueryResultVersion(Compiled.Provider, Version));
+	}
+	return true;
+}
+
 void USussBrainComponent::IntersectCorrelatedContexts(AActor* Self,
                                                    const FSussQuery& Query,
                                                    USussQueryProvider* QueryProvider,
@@ -1072,23 +1773,25 @@ void USussBrainComponent::IntersectCorrelatedContexts(AActor* Self,
 	// Correlated results run a query once for each existing context generated from previous queries, then combine the
 	// results with that one context, meaning that instead of C * N contexts, you get N(C1) + N(C2) + .. N(Cx) contexts
 
-	auto Pool = GetSussPool(GetWorld());
+	FSussUpdateArena& Arena = FSussUpdateArena::Get();
 	const auto Element = QueryProvider->GetProvidedContextElement();
 
 	int InContextCount = InOutContexts.Num();
 
 	for (int i = 0; i < InContextCount; ++i)
 	{
+		// Results for each source context are only needed until they're combined into contexts
+		FSussUpdateArenaMark ArenaMark;
 		FSussContext& SourceContext = InOutContexts[i];
 		int NumResults = 0;
 		switch(Element)
 		{
 		case ESussQueryContextElement::Target:
 			{
-				FSussScopeReservedArray Targets = Pool->ReserveArray<TWeakObjectPtr<AActor>>();
-				QueryProvider->GetResultsInContext<TWeakObjectPtr<AActor>>(this, Self, SourceContext, Params, *Targets.Get<TWeakObjectPtr<AActor>>());
+				TArray<TWeakObjectPtr<AActor>>& Targets = Arena.AcquireArray<TWeakObjectPtr<AActor>>();
+				QueryProvider->GetResultsInContext<TWeakObjectPtr<AActor>>(this, Self, SourceContext, Params, Targets);
 
-				NumResults = Targets.Get<TWeakObjectPtr<AActor>>()->Num();
+				NumResults = Targets.Num();
 				if (NumResults > 0)
 				{
 					AppendCorrelatedContexts<TWeakObjectPtr<AActor>>(Self,
@@ -1105,10 +1808,10 @@ void USussBrainComponent::IntersectCorrelatedContexts(AActor* Self,
 			}
 		case ESussQueryContextElement::Location:
 			{
-				FSussScopeReservedArray Targets = Pool->ReserveArray<FVector>();
-				QueryProvider->GetResultsInContext<FVector>(this, Self, SourceContext, Params, *Targets.Get<FVector>());
+				TArray<FVector>& Targets = Arena.AcquireArray<FVector>();
+				QueryProvider->GetResultsInContext<FVector>(this, Self, SourceContext, Params, Targets);
 
-				NumResults = Targets.Get<FVector>()->Num();
+				NumResults = Targets.Num();
 				if (NumResults > 0)
 				{
 					AppendCorrelatedContexts<FVector>(Self,
@@ -1127,9 +1830,9 @@ void USussBrainComponent::IntersectCorrelatedContexts(AActor* Self,
 				if (auto NQP = Cast<USussNamedValueQueryProvider>(QueryProvider))
 				{
 					const FName ValueName = NQP->GetQueryValueName();
-					FSussScopeReservedArray NamedValues = Pool->ReserveArray<FSussContextValue>();
-					QueryProvider->GetResultsInContext<FSussContextValue>(this, Self, SourceContext, Params, *NamedValues.Get<FSussContextValue>());
-					NumResults = NamedValues.Get<FSussContextValue>()->Num();
+					TArray<FSussContextValue>& NamedValues = Arena.AcquireArray<FSussContextValue>();
+					QueryProvider->GetResultsInContext<FSussContextValue>(this, Self, SourceContext, Params, NamedValues);
+					NumResults = NamedValues.Num();
 					if (NumResults > 0)
 					{
 						AppendCorrelatedContexts<FSussContextValue>(Self,
@@ -1158,25 +1861,74 @@ void USussBrainComponent::IntersectCorrelatedContexts(AActor* Self,
 	}
 }
 
+template <typename T>
+void USussBrainComponent::GetRequesterResults(AActor* Self,
+                                              const FSussQuery& Query,
+                                              USussQueryProvider* QueryProvider,
+                                              const TMap<FName, FSussParameter>& Params,
+                                              TArray<T>& OutResults,
+                                              uint32& OutVersion)
+{
+	// Copied out because the provider's cached results can be replaced by another requester once we let go of them;
+	// scratch arrays keep their allocations so this doesn't allocate once warmed up
+	QueryProvider->GetResults<T>(this, Self, Query.MaxFrequency, Params, OutResults, OutVersion);
+	QueryProvider->FilterResultsForRequester(this, Self, Params, OutResults);
+}
+
+template <typename T>
+static TArray<T>& ResetResultsArray(TSussResultsArray& Results)
+{
+	if (!Results.IsType<TArray<T>>())
+	{
+		Results.Set<TArray<T>>(TArray<T>());
+	}
+	TArray<T>& Array = Results.Get<TArray<T>>();
+	Array.Reset();
+	return Array;
+}
+
+uint32 USussBrainComponent::FetchUncorrelatedResults(AActor* Self,
+                                                     const FSussCompiledQuery& Compiled,
+                                                     const TMap<FName, FSussParameter>& Params,
+                                                     TSussResultsArray& OutResults)
+{
+	uint32 Version = 0;
+	switch (Compiled.Provider->GetProvidedContextElement())
+	{
+	case ESussQueryContextElement::Target:
+		GetRequesterResults(Self, *Compiled.Query, Compiled.Provider, Params, ResetResultsArray<TWeakObjectPtr<AActor>>(OutResults), Version);
+		break;
+	case ESussQueryContextElement::Location:
+		GetRequesterResults(Self, *Compiled.Query, Compiled.Provider, Params, ResetResultsArray<FVector>(OutResults), Version);
+		break;
+	case ESussQueryContextElement::NamedValue:
+		{
+			TArray<FSussContextValue>& NamedValues = ResetResultsArray<FSussContextValue>(OutResults);
+			// Values can't be added to contexts without a name, so don't bother running the query
+			if (Cast<USussNamedValueQueryProvider>(Compiled.Provider))
+			{
+				GetRequesterResults(Self, *Compiled.Query, Compiled.Provider, Params, NamedValues, Version);
+			}
+			break;
+		}
+	}
+	return Version;
+}
+
 bool USussBrainComponent::AppendUncorrelatedContexts(AActor* Self,
-                                                     const FSussQuery& Query,
                                                      USussQueryProvider* QueryProvider,
-                                                     const TMap<FName, FSussParameter>& Params,
+                                                     const TSussResultsArray& Results,
                                                      TArray<FSussContext>& OutContexts)
 {
 	// Uncorrelated results run a query once, and combine the results in every combination with any existing
 
-	auto Pool = GetSussPool(GetWorld());
 	const auto Element = QueryProvider->GetProvidedContextElement();
 	bool bAnyResults = false;
 	switch (Element)
 	{
 	case ESussQueryContextElement::Target:
 		{
-			FSussScopeReservedArray Targets = Pool->ReserveArray<TWeakObjectPtr<AActor>>();
-			const auto TargetArray = Targets.Get<TWeakObjectPtr<AActor>>();
-			TargetArray->Append(
-				QueryProvider->GetResults<TWeakObjectPtr<AActor>>(this, Self, Query.MaxFrequency, Params));
+			const auto& Targets = Results.Get<TArray<TWeakObjectPtr<AActor>>>();
 			AppendUncorrelatedContexts<TWeakObjectPtr<AActor>>(Self,
 			                                       Targets,
 			                                       OutContexts,
@@ -1184,15 +1936,12 @@ bool USussBrainComponent::AppendUncorrelatedContexts(AActor* Self,
 			                                       {
 				                                       Ctx.Target = Target;
 			                                       });
-			bAnyResults = TargetArray->Num() > 0;
+			bAnyResults = Targets.Num() > 0;
 			break;
 		}
 	case ESussQueryContextElement::Location:
 		{
-			FSussScopeReservedArray Locations = Pool->ReserveArray<FVector>();
-			const auto LocationArray = Locations.Get<FVector>();
-			LocationArray->Append(
-				QueryProvider->GetResults<FVector>(this, Self, Query.MaxFrequency, Params));
+			const auto& Locations = Results.Get<TArray<FVector>>();
 			AppendUncorrelatedContexts<FVector>(Self,
 			                        Locations,
 			                        OutContexts,
@@ -1200,7 +1949,7 @@ bool USussBrainComponent::AppendUncorrelatedContexts(AActor* Self,
 			                        {
 				                        Ctx.Location = Loc;
 			                        });
-			bAnyResults = LocationArray->Num() > 0;
+			bAnyResults = Locations.Num() > 0;
 			break;
 		}
 	case ESussQueryContextElement::NamedValue:
@@ -1208,10 +1957,7 @@ bool USussBrainComponent::AppendUncorrelatedContexts(AActor* Self,
 			if (auto NQP = Cast<USussNamedValueQueryProvider>(QueryProvider))
 			{
 				const FName ValueName = NQP->GetQueryValueName();
-				FSussScopeReservedArray NamedValues = Pool->ReserveArray<FSussContextValue>();
-				const auto ValArray = NamedValues.Get<FSussContextValue>();
-				ValArray->Append(
-					QueryProvider->GetResults<FSussContextValue>(this, Self, Query.MaxFrequency, Params));
+				const auto& NamedValues = Results.Get<TArray<FSussContextValue>>();
 				AppendUncorrelatedContexts<FSussContextValue>(Self,
 				                                  NamedValues,
 				                                  OutContexts,
@@ -1219,7 +1965,7 @@ bool USussBrainComponent::AppendUncorrelatedContexts(AActor* Self,
 				                                  {
 					                                  Ctx.NamedValues.Add(ValueName, Value);
 				                                  });
-				bAnyResults = ValArray->Num() > 0;
+				bAnyResults = NamedValues.Num() > 0;
 			}
 			break;
 		}
@@ -1284,7 +2030,7 @@ bool USussBrainComponent::ShouldSubtractRepetitionPenaltyToProposedAction(int Ne
 	// We only add repetition penalties to previously run actions
 	if (!IsActionInProgress() || NewActionIndex != CurrentActionResult.ActionDefIndex)
 	{
-		return ActionHistory[NewActionIndex].LastEndTime > 0;
+		return GetBrainStates().GetLastEndTimes(StateHandle)[NewActionIndex] > 0;
 	}
 	return false;
 }
@@ -1351,18 +2097,14 @@ double USussBrainComponent::GetTimeSinceActionPerformed(FGameplayTag ActionTag)
 {
 	double LastTime = -UE_DOUBLE_BIG_NUMBER;
 
-	if (ActionTag.IsValid())
+	if (ActionTag.IsValid() && ActionTable.IsValid())
 	{
-		for (int i = 0; i < ActionHistory.Num(); ++i)
+		// Use the last END time, that way an action can ask about its *own* last run during execution
+		// If we used the start time then if you did that you'd only ever get 0 seconds
+		const int32 TagIndex = ActionTable->FindActionTagIndex(ActionTag);
+		if (LastEndTimeByTag.IsValidIndex(TagIndex))
 		{
-			const auto& H = ActionHistory[i];
-			const auto& Def = CombinedActionsByPriority[i];
-			if (Def.ActionTag == ActionTag)
-			{
-				// Use the last END time, that way an action can ask about its *own* last run during execution
-				// If we used the start time then if you did that you'd only ever get 0 seconds
-				LastTime = FMath::Max(LastTime, H.LastEndTime);
-			}
+			LastTime = LastEndTimeByTag[TagIndex];
 		}
 	}
 	return GetWorld()->GetTimeSeconds() - LastTime;
@@ -1370,115 +2112,125 @@ double USussBrainComponent::GetTimeSinceActionPerformed(FGameplayTag ActionTag)
 
 void USussBrainComponent::OnPerceptionUpdated(const TArray<AActor*>& Actors)
 {
-	if (DistanceCategory != ESussDistanceCategory::OutOfRange)
+	// Perception queries will re-run on next request; their versions only change if their results do
+	InvalidatePerceptionQueries();
+
+	const auto Settings = GetDefault<USussSettings>();
+	if (Settings && Settings->BrainUpdateOnPerceptionChanges && DistanceCategory != ESussDistanceCategory::OutOfRange)
 	{
 		QueueForUpdate();
 	}
 }
 
-void USussBrainComponent::SetTemporaryActionScoreAdjustment(FGameplayTag ActionTag, float Value, float CooldownTime)
+void USussBrainComponent::InvalidatePerceptionQueries()
 {
-	// Can potentially apply to multiple actions, if the same tag is used multiple times with eg diff params
-	for (int i = 0; i < CombinedActionsByPriority.Num(); ++i)
+	TArray<USussQueryProvider*, TInlineAllocator<8>> ProvidersToInvalidate;
+	for (const auto& CompiledAction : GetCompiledActions())
 	{
-		if (CombinedActionsByPriority[i].ActionTag == ActionTag)
+		for (const auto& Compiled : CompiledAction.Queries)
 		{
-			SetTemporaryActionScoreAdjustment(i, Value, CooldownTime);
+			if (Compiled.Provider->ShouldInvalidateOnPerceptionUpdate())
+			{
+				ProvidersToInvalidate.AddUnique(Compiled.Provider);
+			}
 		}
 	}
+
+	AActor* Self = GetSelf();
+	for (auto QueryProvider : ProvidersToInvalidate)
+	{
+		QueryProvider->InvalidateCachedResults(Self);
+	}
+}
+
+void USussBrainComponent::SetTemporaryActionScoreAdjustment(FGameplayTag ActionTag, float Value, float CooldownTime)
+{
+	// Can potentially apply to multiple actions, if the same tag is used multiple times with eg diff params
+	for (const int32 i : FindActionIndices(ActionTag))
+	{
+		SetTemporaryActionScoreAdjustment(i, Value, CooldownTime);
+	}
 }
 
 void USussBrainComponent::AddTemporaryActionScoreAdjustment(FGameplayTag ActionTag, float Value, float CooldownTime)
 {
 	// Can potentially apply to multiple actions, if the same tag is used multiple times with eg diff params
-	for (int i = 0; i < CombinedActionsByPriority.Num(); ++i)
+	for (const int32 i : FindActionIndices(ActionTag))
 	{
-		if (CombinedActionsByPriority[i].ActionTag == ActionTag)
-		{
-			AddTemporaryActionScoreAdjustment(i, Value, CooldownTime);
-		}
+		AddTemporaryActionScoreAdjustment(i, Value, CooldownTime);
 	}
 }
 
 void USussBrainComponent::ResetTemporaryActionScoreAdjustment(FGameplayTag ActionTag)
 {
 	// Can potentially apply to multiple actions, if the same tag is used multiple times with eg diff params
-	for (int i = 0; i < CombinedActionsByPriority.Num(); ++i)
+	for (const int32 i : FindActionIndices(ActionTag))
 	{
-		if (CombinedActionsByPriority[i].ActionTag == ActionTag)
-		{
-			ResetTemporaryActionScoreAdjustment(i);
-		}
+		ResetTemporaryActionScoreAdjustment(i);
 	}
 }
 
 void USussBrainComponent::ResetAllTemporaryActionScoreAdjustments()
 {
-	for (int i = 0; i < ActionHistory.Num(); ++i)
-	{
-		ActionHistory[i].TempScoreAdjust = 0;
-	}
+	GetBrainStates().ResetAllTempScoreAdjusts(StateHandle);
 }
 
 void USussBrainComponent::SetTemporaryActionScoreAdjustment(int ActionIndex, float Value, float CooldownTime)
 {
-	if (ActionHistory.IsValidIndex(ActionIndex))
-	{
-		auto& H = ActionHistory[ActionIndex];
-		H.TempScoreAdjust = Value;
-		H.TempScoreAdjustCooldownRate = CooldownTime > 0 ? Value / CooldownTime : 0;
-	}
+	GetBrainStates().SetTempScoreAdjust(StateHandle,
+		ActionIndex,
+		Value,
+		CooldownTime > 0 ? Value / CooldownTime : 0,
+		GetWorld()->GetTimeSeconds());
 }
 
 void USussBrainComponent::AddTemporaryActionScoreAdjustment(int ActionIndex, float Value, float CooldownTime)
 {
-	if (ActionHistory.IsValidIndex(ActionIndex))
+	auto& States = GetBrainStates();
+	if (ActionIndex >= 0 && ActionIndex < States.GetNumActions(StateHandle))
 	{
-		auto& H = ActionHistory[ActionIndex];
+		const double Now = GetWorld()->GetTimeSeconds();
+		float Adjust = States.GetTempScoreAdjust(StateHandle, ActionIndex, Now);
+		const float CooldownRate = States.GetTempScoreAdjustCooldownRate(StateHandle, ActionIndex);
 		float PrevCooldownTimeRemaining = 0;
-		if (!FMath::IsNearlyZero(H.TempScoreAdjust) && !FMath::IsNearlyZero(H.TempScoreAdjustCooldownRate))
+		if (!FMath::IsNearlyZero(Adjust) && !FMath::IsNearlyZero(CooldownRate))
 		{
-			PrevCooldownTimeRemaining = H.TempScoreAdjustCooldownRate > 0 ? H.TempScoreAdjust / H.TempScoreAdjustCooldownRate : 0;
+			PrevCooldownTimeRemaining = CooldownRate > 0 ? Adjust / CooldownRate : 0;
 		}
-		H.TempScoreAdjust += Value;
+		Adjust += Value;
 		const float NewCooldownTime = CooldownTime + PrevCooldownTimeRemaining;
-		H.TempScoreAdjustCooldownRate = NewCooldownTime > 0 ? H.TempScoreAdjust / NewCooldownTime : 0;
+		States.SetTempScoreAdjust(StateHandle, ActionIndex, Adjust, NewCooldownTime > 0 ? Adjust / NewCooldownTime : 0, Now);
 	}
 }
 
 void USussBrainComponent::ResetTemporaryActionScoreAdjustment(int ActionIndex)
 {
-	if (ActionHistory.IsValidIndex(ActionIndex))
-	{
-		auto& H = ActionHistory[ActionIndex];
-		H.TempScoreAdjust = 0;
-		H.TempScoreAdjustCooldownRate = 0;
-	}
+	GetBrainStates().SetTempScoreAdjust(StateHandle, ActionIndex, 0, 0, GetWorld()->GetTimeSeconds());
 }
 
 FString USussBrainComponent::GetDebugSummaryString() const
 {
 	TStringBuilder<256> Builder;
-	Builder.Appendf(TEXT("Distance Category: %s  UpdateFreq: %4.2f\n"), *StaticEnum<ESussDistanceCategory>()->GetValueAsString(DistanceCategory), CurrentUpdateInterval);
+	Builder.Appendf(TEXT("Distance Category: %s  UpdateFreq: %4.2f\n"), *StaticEnum<ESussDistanceCategory>()->GetValueAsString(DistanceCategory), GetCurrentUpdateInterval());
 	if (bIsLogicStopped)
 	{
 		Builder.Appendf(TEXT("Logic currently stopped, reason: %s\n"),*LogicStoppedReason);
 	}
 	
-	if (CombinedActionsByPriority.IsValidIndex(CurrentActionResult.ActionDefIndex))
+	if (GetActionDefs().IsValidIndex(CurrentActionResult.ActionDefIndex))
 	{
 		// Log all actions
 		// Log all considerations?
-		const FSussActionDef& Def = CombinedActionsByPriority[CurrentActionResult.ActionDefIndex];
-		const auto& H = ActionHistory[CurrentActionResult.ActionDefIndex];
+		const FSussActionDef& Def = GetActionDefs()[CurrentActionResult.ActionDefIndex];
+		const auto& States = GetBrainStates();
 		Builder.Appendf(
 			TEXT(
 				"Current Action: {yellow}%s{white}\nOriginal Score: {yellow}%4.2f{white}\nCurrent Score: {yellow}%4.2f{white}"),
-				Def.Description.IsEmpty() ? 
-					*CurrentActionInstance->GetClass()->GetName() :
-					*Def.Description,
-				H.LastRunScore,
-				CurrentActionResult.Score);
+				!Def.Description.IsEmpty() ? *Def.Description :
+					CurrentActionInstance.IsValid() ? *CurrentActionInstance->GetClass()->GetName() :
+					*Def.ActionTag.ToString(),
+				States.GetLastRunScores(StateHandle)[CurrentActionResult.ActionDefIndex],
+				GetCurrentActionScore());
 	}
 
 	return Builder.ToString();
@@ -1491,6 +2243,10 @@ void USussBrainComponent::DebugLocations(TArray<FVector>& OutLocations, bool bIn
 	{
 		CurrentActionInstance->DebugLocations(OutLocations, bIncludeDetails);
 	}
+	else if (CurrentNativeAction)
+	{
+		CurrentNativeAction->DebugLocations(OutLocations, bIncludeDetails);
+	}
 }
 
 void USussBrainComponent::GetDebugDetailLines(TArray<FString>& OutLines) const
@@ -1499,7 +2255,7 @@ void USussBrainComponent::GetDebugDetailLines(TArray<FString>& OutLines) const
 	OutLines.Add(TEXT("Candidate Actions:"));
 	for (const auto& Action : CandidateActions)
 	{
-		const FSussActionDef& Def = CombinedActionsByPriority[Action.ActionDefIndex];
+		const FSussActionDef& Def = GetActionDefs()[Action.ActionDefIndex];
 		OutLines.Add(FString::Printf(
 			TEXT(" - {yellow}%s  {white}%4.2f"),
 			Def.Description.IsEmpty()
@@ -1510,4 +2266,29 @@ void USussBrainComponent::GetDebugDetailLines(TArray<FString>& OutLines) const
 
 		// If we want to list consideration scores here, we have to store them
 	}
+
+	TSet<const USussInputProvider*> CachingInputs;
+	for (const auto& Action : GetCompiledActions())
+	{
+		for (const auto& Consideration : Action.Considerations)
+		{
+			if (Consideration.InputProvider->IsCachingValues())
+			{
+				CachingInputs.Add(Consideration.InputProvider);
+			}
+		}
+	}
+	if (CachingInputs.Num() > 0)
+	{
+		OutLines.Add(TEXT("Cached Inputs (all brains):"));
+		for (const auto Input : CachingInputs)
+		{
+			OutLines.Add(FString::Printf(
+				TEXT(" - {yellow}%s  {white}%llu hits / %llu misses (%3.1f%%)"),
+				*Input->GetInputTag().ToString(),
+				Input->GetCacheHits(),
+				Input->GetCacheMisses(),
+				Input->GetCacheHitRate() * 100.f));
+		}
+	}
 }
@@ -0,0 +1,280 @@
+﻿#include "SussBrainStateStore.h"
+
+FSussBrainHandle FSussBrainStateStore::AllocateBrain()
+{
+	FSussBrainHandle Handle;
+	if (FreeBrainIndices.Num() > 0)
+	{
+		Handle.Index = FreeBrainIndices.Pop();
+	}
+	else
+	{
+		Handle.Index = Generations.Add(0);
+		ActionRangeStarts.Add(0);
+		ActionRangeNums.Add(0);
+		CurrentActionIndices.Add(INDEX_NONE);
+		CurrentScores.Add(0);
+		CurrentScoreStartTimes.Add(0);
+		CurrentScoreDecayRates.Add(0);
+		UpdateIntervals.Add(0);
+		DecayClockOffsets.Add(0);
+		DecayInactiveSince.Add(0);
+	}
+	// Generation 0 is never handed out, so a default handle with a stale index can't match
+	Handle.Generation = ++Generations[Handle.Index];
+
+	ActionRangeStarts[Handle.Index] = 0;
+	ActionRangeNums[Handle.Index] = 0;
+	CurrentActionIndices[Handle.Index] = INDEX_NONE;
+	CurrentScores[Handle.Index] = 0;
+	CurrentScoreStartTimes[Handle.Index] = 0;
+	CurrentScoreDecayRates[Handle.Index] = 0;
+	UpdateIntervals[Handle.Index] = 0;
+	// Decay starts inactive with the clock at 0
+	DecayClockOffsets[Handle.Index] = 0;
+	DecayInactiveSince[Handle.Index] = 0;
+
+	return Handle;
+}
+
+void FSussBrainStateStore::FreeBrain(FSussBrainHandle& Handle)
+{
+	if (IsValid(Handle))
+	{
+		FreeActionRange(ActionRangeStarts[Handle.Index], ActionRangeNums[Handle.Index]);
+		ActionRangeNums[Handle.Index] = 0;
+		// Invalidates any other copies of the handle
+		++Generations[Handle.Index];
+		FreeBrainIndices.Add(Handle.Index);
+	}
+	Handle.Reset();
+}
+
+void FSussBrainStateStore::SetNumActions(const FSussBrainHandle& Handle, int32 NumActions)
+{
+	if (!IsValid(Handle))
+		return;
+
+	const int32 OldStart = ActionRangeStarts[Handle.Index];
+	const int32 OldNum = ActionRangeNums[Handle.Index];
+	if (OldNum == NumActions)
+		return;
+
+	// Existing entries are kept, like resizing an array
+	const int32 NewStart = AllocateActionRange(NumActions);
+	const int32 NumKept = FMath::Min(OldNum, NumActions);
+	for (int32 i = 0; i < NumKept; ++i)
+	{
+		LastStartTimes[NewStart + i] = LastStartTimes[OldStart + i];
+		LastEndTimes[NewStart + i] = LastEndTimes[OldStart + i];
+		LastRunScores[NewStart + i] = LastRunScores[OldStart + i];
+		RepetitionPenalties[NewStart + i] = RepetitionPenalties[OldStart + i];
+		RepetitionPenaltyStartTimes[NewStart + i] = RepetitionPenaltyStartTimes[OldStart + i];
+		RepetitionPenaltyDecayRates[NewStart + i] = RepetitionPenaltyDecayRates[OldStart + i];
+		TempScoreAdjusts[NewStart + i] = TempScoreAdjusts[OldStart + i];
+		TempScoreAdjustStartTimes[NewStart + i] = TempScoreAdjustStartTimes[OldStart + i];
+		TempScoreAdjustCooldownRates[NewStart + i] = TempScoreAdjustCooldownRates[OldStart + i];
+	}
+	ResetActionRange(NewStart + NumKept, NumActions - NumKept);
+	FreeActionRange(OldStart, OldNum);
+	ActionRangeStarts[Handle.Index] = NewStart;
+	ActionRangeNums[Handle.Index] = NumActions;
+}
+
+void FSussBrainStateStore::SetDecayActive(const FSussBrainHandle& Handle, bool bActive, double Time)
+{
+	if (!IsValid(Handle))
+		return;
+
+	double& InactiveSince = DecayInactiveSince[Handle.Index];
+	const bool bWasActive = InactiveSince < 0;
+	if (bActive && !bWasActive)
+	{
+		// Clock resumes from where it stopped
+		DecayClockOffsets[Handle.Index] += FMath::Max(Time - InactiveSince, 0.0);
+		InactiveSince = -1;
+	}
+	else if (!bActive && bWasActive)
+	{
+		InactiveSince = Time;
+	}
+}
+
+void FSussBrainStateStore::StartCurrentAction(const FSussBrainHandle& Handle,
+	int32 ActionIndex,
+	float Score,
+	float ScoreDecayRate,
+	double Time)
+{
+	if (!IsValid(Handle))
+		return;
+
+	const double Clock = GetDecayClock(Handle.Index, Time);
+	CurrentActionIndices[Handle.Index] = ActionIndex;
+	CurrentScores[Handle.Index] = Score;
+	CurrentScoreStartTimes[Handle.Index] = Clock;
+	CurrentScoreDecayRates[Handle.Index] = ScoreDecayRate;
+
+	// Freeze the repetition penalty at its current value while this action runs
+	const int32 i = GetActionStateIndex(Handle, ActionIndex);
+	if (i != INDEX_NONE)
+	{
+		RepetitionPenalties[i] = Decay(RepetitionPenalties[i], RepetitionPenaltyDecayRates[i], RepetitionPenaltyStartTimes[i], Clock);
+		RepetitionPenaltyStartTimes[i] = Clock;
+	}
+}
+
+void FSussBrainStateStore::SetCurrentScore(const FSussBrainHandle& Handle, float Score, double Time)
+{
+	if (!IsValid(Handle))
+		return;
+
+	CurrentScores[Handle.Index] = Score;
+	CurrentScoreStartTimes[Handle.Index] = GetDecayClock(Handle.Index, Time);
+}
+
+void FSussBrainStateStore::EndCurrentAction(const FSussBrainHandle& Handle, float RepetitionPenalty, double Time)
+{
+	if (!IsValid(Handle))
+		return;
+
+	const int32 i = GetActionStateIndex(Handle, CurrentActionIndices[Handle.Index]);
+	if (i != INDEX_NONE)
+	{
+		LastEndTimes[i] = Time;
+		// Penalty was frozen while running, starts bleeding away from now
+		RepetitionPenalties[i] += RepetitionPenalty;
+		RepetitionPenaltyStartTimes[i] = GetDecayClock(Handle.Index, Time);
+	}
+	CurrentActionIndices[Handle.Index] = INDEX_NONE;
+	CurrentScores[Handle.Index] = 0;
+}
+
+float FSussBrainStateStore::GetCurrentScore(const FSussBrainHandle& Handle, double Time) const
+{
+	if (!IsValid(Handle) || CurrentActionIndices[Handle.Index] == INDEX_NONE)
+		return 0;
+
+	return Decay(CurrentScores[Handle.Index],
+		CurrentScoreDecayRates[Handle.Index],
+		CurrentScoreStartTimes[Handle.Index],
+		GetDecayClock(Handle.Index, Time));
+}
+
+float FSussBrainStateStore::GetRepetitionPenalty(const FSussBrainHandle& Handle, int32 ActionIndex, double Time) const
+{
+	const int32 i = GetActionStateIndex(Handle, ActionIndex);
+	if (i == INDEX_NONE)
+		return 0;
+
+	// Doesn't bleed away while the action is current
+	if (ActionIndex == CurrentActionIndices[Handle.Index])
+		return RepetitionPenalties[i];
+
+	return Decay(RepetitionPenalties[i], RepetitionPenaltyDecayRates[i], RepetitionPenaltyStartTimes[i], GetDecayClock(Handle.Index, Time));
+}
+
+float FSussBrainStateStore::GetTempScoreAdjust(const FSussBrainHandle& Handle, int32 ActionIndex, double Time) const
+{
+	const int32 i = GetActionStateIndex(Handle, ActionIndex);
+	if (i == INDEX_NONE)
+		return 0;
+
+	return Decay(TempScoreAdjusts[i], TempScoreAdjustCooldownRates[i], TempScoreAdjustStartTimes[i], GetDecayClock(Handle.Index, Time));
+}
+
+float FSussBrainStateStore::GetTempScoreAdjustCooldownRate(const FSussBrainHandle& Handle, int32 ActionIndex) const
+{
+	const int32 i = GetActionStateIndex(Handle, ActionIndex);
+	return i != INDEX_NONE ? TempScoreAdjustCooldownRates[i] : 0;
+}
+
+void FSussBrainStateStore::SetTempScoreAdjust(const FSussBrainHandle& Handle,
+	int32 ActionIndex,
+	float Value,
+	float CooldownRate,
+	double Time)
+{
+	const int32 i = GetActionStateIndex(Handle, ActionIndex);
+	if (i != INDEX_NONE)
+	{
+		TempScoreAdjusts[i] = Value;
+		TempScoreAdjustStartTimes[i] = GetDecayClock(Handle.Index, Time);
+		TempScoreAdjustCooldownRates[i] = CooldownRate;
+	}
+}
+
+void FSussBrainStateStore::ResetAllTempScoreAdjusts(const FSussBrainHandle& Handle)
+{
+	for (float& Adjust : Slice(TempScoreAdjusts, Handle))
+	{
+		Adjust = 0;
+	}
+}
+
+int32 FSussBrainStateStore::AllocateActionRange(int32 Num)
+{
+	if (Num <= 0)
+		return 0;
+
+	if (auto pFree = FreeActionRanges.Find(Num))
+	{
+		if (pFree->Num() > 0)
+		{
+			return pFree->Pop();
+		}
+	}
+
+	const int32 Start = LastStartTimes.Num();
+	LastStartTimes.AddUninitialized(Num);
+	LastEndTimes.AddUninitialized(Num);
+	LastRunScores.AddUninitialized(Num);
+	RepetitionPenalties.AddUninitialized(Num);
+	RepetitionPenaltyStartTimes.AddUninitialized(Num);
+	RepetitionPenaltyDecayRates.AddUninitialized(Num);
+	TempScoreAdjusts.AddUninitialized(Num);
+	TempScoreAdjustStartTimes.AddUninitialized(Num);
+	TempScoreAdjustCooldownRates.AddUninitialized(Num);
+	return Start;
+}
+
+void FSussBrainStateStore::FreeActionRange(int32 Start, int32 Num)
+{
+	if (Num <= 0)
+		return;
+
+	if (Start + Num == LastStartTimes.Num())
+	{
+		// Last range, just give the space back
+		const int32 NewNum = Start;
+		LastStartTimes.SetNum(NewNum);
+		LastEndTimes.SetNum(NewNum);
+		LastRunScores.SetNum(NewNum);
+		RepetitionPenalties.SetNum(NewNum);
+		RepetitionPenaltyStartTimes.SetNum(NewNum);
+		RepetitionPenaltyDecayRates.SetNum(NewNum);
+		TempScoreAdjusts.SetNum(NewNum);
+		TempScoreAdjustStartTimes.SetNum(NewNum);
+		TempScoreAdjustCooldownRates.SetNum(NewNum);
+	}
+	else
+	{
+		FreeActionRanges.FindOrAdd(Num).Add(Start);
+	}
+}
+
+void FSussBrainStateStore::ResetActionRange(int32 Start, int32 Num)
+{
+	for (int32 i = Start; i < Start + Num; ++i)
+	{
+		LastStartTimes[i] = -UE_DOUBLE_BIG_NUMBER;
+		LastEndTimes[i] = -UE_DOUBLE_BIG_NUMBER;
+		LastRunScores[i] = 0;
+		RepetitionPenalties[i] = 0;
+		RepetitionPenaltyStartTimes[i] = 0;
+		RepetitionPenaltyDecayRates[i] = 0;
+		TempScoreAdjusts[i] = 0;
+		TempScoreAdjustStartTimes[i] = 0;
+		TempScoreAdjustCooldownRates[i] = 0;
+	}
+}
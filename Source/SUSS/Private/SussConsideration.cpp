@@ -2,6 +2,48 @@
 #include "SussConsideration.h"
 
 #include "SussUtility.h"
+#include "Curves/CurveFloat.h"
+
+
+void FSussCurveLUT::Bake(const UCurveFloat* Curve, int Resolution)
+{
+	Resolution = FMath::Max(Resolution, 2);
+	Samples.Reset();
+	MaxError = 0;
+
+	if (!IsValid(Curve))
+	{
+		Samples.SetNumZeroed(Resolution);
+		return;
+	}
+
+	const float Step = 1.f / (Resolution - 1);
+	for (int i = 0; i < Resolution; ++i)
+	{
+		Samples.Add(Curve->GetFloatValue(i * Step));
+	}
+
+	// Error is largest in between samples, so measure there
+	constexpr int ErrorSubSamples = 4;
+	for (int i = 0; i < Resolution - 1; ++i)
+	{
+		for (int s = 1; s < ErrorSubSamples; ++s)
+		{
+			const float Input = (i + (float)s / ErrorSubSamples) * Step;
+			MaxError = FMath::Max(MaxError, FMath::Abs(Evaluate(Input) - Curve->GetFloatValue(Input)));
+		}
+	}
+}
+
+void FSussCurveLUT::EvaluateBatch(TConstArrayView<float> Inputs, TArrayView<float> OutScores) const
+{
+	check(Inputs.Num() == OutScores.Num());
+
+	for (int i = 0; i < Inputs.Num(); ++i)
+	{
+		OutScores[i] = Evaluate(Inputs[i]);
+	}
+}
 
 
 float FSussConsideration::EvaluateCurve(float Input) const
@@ -20,3 +62,20 @@ float FSussConsideration::EvaluateCurve(float Input) const
 
 	return 0;	
 }
+
+void FSussConsideration::EvaluateCurveBatch(TConstArrayView<float> Inputs, TArrayView<float> OutScores) const
+{
+	check(Inputs.Num() == OutScores.Num());
+	
+	if (CurveType == ESussCurveType::Custom)
+	{
+		for (int i = 0; i < Inputs.Num(); ++i)
+		{
+			OutScores[i] = IsValid(CustomCurve) ? CustomCurve->GetFloatValue(Inputs[i]) : 0;
+		}
+	}
+	else
+	{
+		USussUtility::EvalCurveBatch(CurveType, Inputs, OutScores, CurveParams);
+	}
+}
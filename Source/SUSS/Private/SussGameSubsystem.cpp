@@ -1,9 +1,11 @@
 ﻿
 #include "SussGameSubsystem.h"
 
+#include "SussBrainComponent.h"
 #include "SussCommon.h"
 #include "SussDummyProviders.h"
 #include "SussSettings.h"
+#include "Curves/CurveFloat.h"
 #include "Engine/ObjectLibrary.h"
 #include "..\Public\Inputs\SussPerceptionInputProviders.h"
 #include "Actions/SussAbilityActions.h"
@@ -19,6 +21,8 @@ void USussGameSubsystem::Initialize(FSubsystemCollectionBase& Collection)
 
 	DefaultInputProvider = NewObject<USussDummyInputProvider>();
 
+	RefreshDisabledActions();
+
 	RegisterNativeProviders();
 
 	// Set up libraries for actions / input / query providers, for scanning for assets
@@ -120,6 +124,25 @@ void USussGameSubsystem::Initialize(FSubsystemCollectionBase& Collection)
 		}
 		
 	}
+
+#if WITH_EDITOR
+	// Curve editing calls Modify before changing keys, property edits notify after; either way re-bake next tick
+	FCoreUObjectDelegates::OnObjectModified.AddUObject(this, &USussGameSubsystem::OnObjectChanged);
+	FCoreUObjectDelegates::OnObjectPropertyChanged.AddWeakLambda(this, [this](UObject* Object, FPropertyChangedEvent&)
+	{
+		OnObjectChanged(Object);
+	});
+#endif
+}
+
+void USussGameSubsystem::Deinitialize()
+{
+#if WITH_EDITOR
+	FCoreUObjectDelegates::OnObjectModified.RemoveAll(this);
+	FCoreUObjectDelegates::OnObjectPropertyChanged.RemoveAll(this);
+#endif
+
+	Super::Deinitialize();
 }
 
 void USussGameSubsystem::RegisterNativeProviders()
@@ -454,7 +477,240 @@ void USussGameSubsystem::Tick(float DeltaTime)
 	{
 		Pair.Value->Tick(DeltaTime);
 	}
+
+#if WITH_EDITOR
+	RebakeDirtyCurves();
+	if (bDisabledActionsDirty)
+	{
+		bDisabledActionsDirty = false;
+		RefreshDisabledActions();
+	}
+#endif
+}
+
+void USussGameSubsystem::SetActionEnabled(FGameplayTag ActionTag, bool bEnabled)
+{
+	// Settings are left alone, they're shared between PIE instances & the editor
+	if (bEnabled)
+	{
+		RuntimeDisabledActionTags.RemoveTag(ActionTag);
+		RuntimeEnabledActionTags.AddTag(ActionTag);
+	}
+	else
+	{
+		RuntimeEnabledActionTags.RemoveTag(ActionTag);
+		RuntimeDisabledActionTags.AddTag(ActionTag);
+	}
+	RefreshDisabledActions();
+}
+
+void USussGameSubsystem::RefreshDisabledActions()
+{
+	FGameplayTagContainer DisabledTags;
+	if (const auto Settings = GetDefault<USussSettings>())
+	{
+		DisabledTags = Settings->DisabledActionTags;
+	}
+	DisabledTags.RemoveTags(RuntimeEnabledActionTags);
+	DisabledTags.AppendTags(RuntimeDisabledActionTags);
+
+	DisabledActionTagSet.Reset();
+	// Container includes parents of the explicit tags
+	for (const auto& Tag : DisabledTags.GetGameplayTagParents())
+	{
+		DisabledActionTagSet.Add(Tag);
+	}
+
+	for (const auto& Pair : ActionTables)
+	{
+		if (auto Table = Pair.Value.Pin())
+		{
+			UpdateActionsEnabled(*Table);
+		}
+	}
+}
+
+void USussGameSubsystem::UpdateActionsEnabled(const FSussActionTable& Table) const
+{
+	Table.ActionEnabled.SetNum(Table.ActionsByPriority.Num());
+	for (int i = 0; i < Table.ActionsByPriority.Num(); ++i)
+	{
+		Table.ActionEnabled[i] = IsActionEnabled(Table.ActionsByPriority[i].ActionTag);
+	}
+}
+
+TSharedRef<const FSussActionTable> USussGameSubsystem::GetActionTable(const FSussBrainConfig& Config,
+	TFunctionRef<void(const FSussActionDef&, FSussCompiledAction&)> CompileAction)
+{
+	const uint32 Hash = FSussActionTable::HashConfigActions(Config);
+
+	TArray<TWeakPtr<const FSussActionTable>*, TInlineAllocator<4>> Candidates;
+	ActionTables.MultiFindPointer(Hash, Candidates);
+	for (auto pWeakTable : Candidates)
+	{
+		if (auto Table = pWeakTable->Pin())
+		{
+			if (Table->IsBuiltFrom(Config))
+			{
+				return Table.ToSharedRef();
+			}
+		}
+	}
+	// Drop tables which are no longer used by any brain
+	for (auto It = ActionTables.CreateKeyIterator(Hash); It; ++It)
+	{
+		if (!It.Value().IsValid())
+		{
+			It.RemoveCurrent();
+		}
+	}
+
+	TSharedRef<FSussActionTable> Table = MakeShared<FSussActionTable>();
+	for (auto ActionSet : Config.ActionSets)
+	{
+		Table->SourceActionSets.Add(ActionSet);
+		// Guard against bad config
+		if (IsValid(ActionSet))
+		{
+			Table->ActionsByPriority.Append(ActionSet->GetActions());
+		}
+	}
+	Table->SourceActionDefs = Config.ActionDefs;
+	Table->ActionsByPriority.Append(Config.ActionDefs);
+
+	// Sort by ascending priority
+	Table->ActionsByPriority.Sort([](const FSussActionDef& A, const FSussActionDef& B)
+	{
+		return A.Priority < B.Priority;
+	});
+
+	// Compile execution plan; ActionsByPriority must not change after this since the plan points into it
+	Table->CompiledActions.SetNum(Table->ActionsByPriority.Num());
+	for (int i = 0; i < Table->ActionsByPriority.Num(); ++i)
+	{
+		CompileAction(Table->ActionsByPriority[i], Table->CompiledActions[i]);
+	}
+
+	// Tag lookups, so finding actions by tag doesn't need to scan them all
+	Table->ActionTagIndexPerAction.SetNum(Table->ActionsByPriority.Num());
+	for (int i = 0; i < Table->ActionsByPriority.Num(); ++i)
+	{
+		const FGameplayTag& Tag = Table->ActionsByPriority[i].ActionTag;
+		int32& TagIndex = Table->ActionTagIndices.FindOrAdd(Tag, INDEX_NONE);
+		if (TagIndex == INDEX_NONE)
+		{
+			TagIndex = Table->ActionIndicesByTag.AddDefaulted();
+		}
+		Table->ActionIndicesByTag[TagIndex].Add(i);
+		Table->ActionTagIndexPerAction[i] = TagIndex;
+	}
+
+	// Required & blocking tags as bits over every tag gating any action, so checking them is bitwise
+	TMap<FGameplayTag, int32> GatingTagIndices;
+	auto GetGatingTagIndex = [&GatingTagIndices, &Table](const FGameplayTag& Tag)
+	{
+		int32& Index = GatingTagIndices.FindOrAdd(Tag, INDEX_NONE);
+		if (Index == INDEX_NONE)
+		{
+			Index = Table->GatingTags.Add(Tag);
+		}
+		return Index;
+	};
+	for (const auto& Def : Table->ActionsByPriority)
+	{
+		for (const auto& Tag : Def.RequiredTags)
+		{
+			GetGatingTagIndex(Tag);
+		}
+		for (const auto& Tag : Def.BlockingTags)
+		{
+			GetGatingTagIndex(Tag);
+		}
+	}
+	for (int i = 0; i < Table->ActionsByPriority.Num(); ++i)
+	{
+		const auto& Def = Table->ActionsByPriority[i];
+		auto& Compiled = Table->CompiledActions[i];
+		Compiled.RequiredTagBits.Init(Table->GatingTags.Num());
+		Compiled.BlockingTagBits.Init(Table->GatingTags.Num());
+		for (const auto& Tag : Def.RequiredTags)
+		{
+			Compiled.RequiredTagBits.Set(GatingTagIndices[Tag]);
+		}
+		for (const auto& Tag : Def.BlockingTags)
+		{
+			Compiled.BlockingTagBits.Set(GatingTagIndices[Tag]);
+		}
+		Compiled.bHasRequiredTags = Def.RequiredTags.Num() > 0;
+		Compiled.bHasBlockingTags = Def.BlockingTags.Num() > 0;
+	}
+
+	UpdateActionsEnabled(*Table);
+
+	ActionTables.Add(Hash, Table);
+	return Table;
+}
+
+TSharedRef<const FSussCurveLUT> USussGameSubsystem::GetCurveLUT(UCurveFloat* Curve, int Resolution)
+{
+	const auto Key = MakeTuple(TObjectKey<UCurveFloat>(Curve), Resolution);
+	if (const auto pLUT = CurveLUTs.Find(Key))
+	{
+		return *pLUT;
+	}
+
+	TSharedRef<FSussCurveLUT> LUT = MakeShared<FSussCurveLUT>();
+	BakeCurveLUT(Curve, Resolution, *LUT);
+	CurveLUTs.Add(Key, LUT);
+	return LUT;
+}
+
+void USussGameSubsystem::BakeCurveLUT(UCurveFloat* Curve, int Resolution, FSussCurveLUT& LUT)
+{
+	LUT.Bake(Curve, Resolution);
+
+	if (LUT.MaxError > GetDefault<USussSettings>()->CustomCurveBakeErrorWarningThreshold)
+	{
+		UE_LOG(LogSuss, Warning, TEXT("Custom curve %s baked at resolution %d has a max error of %f, consider increasing CustomCurveResolution on considerations using it"),
+			*GetNameSafe(Curve), Resolution, LUT.MaxError);
+	}
+	else
+	{
+		UE_LOG(LogSuss, Verbose, TEXT("Custom curve %s baked at resolution %d, max error %f"),
+			*GetNameSafe(Curve), Resolution, LUT.MaxError);
+	}
+}
+
+#if WITH_EDITOR
+void USussGameSubsystem::OnObjectChanged(UObject* Object)
+{
+	if (UCurveFloat* Curve = Cast<UCurveFloat>(Object))
+	{
+		DirtyCurves.Add(Curve);
+	}
+	else if (Object == GetDefault<USussSettings>())
+	{
+		bDisabledActionsDirty = true;
+	}
+}
+
+void USussGameSubsystem::RebakeDirtyCurves()
+{
+	if (DirtyCurves.IsEmpty())
+		return;
+
+	// Re-bake in place so brains holding on to these tables pick up the changes
+	for (auto& Pair : CurveLUTs)
+	{
+		const TObjectKey<UCurveFloat>& CurveKey = Pair.Key.Key;
+		if (DirtyCurves.Contains(CurveKey))
+		{
+			BakeCurveLUT(CurveKey.ResolveObjectPtr(), Pair.Key.Value, *Pair.Value);
+		}
+	}
+	DirtyCurves.Reset();
 }
+#endif
 
 void USussGameSubsystem::LoadClassesFromLibrary(const TArray<FDirectoryPath>& Paths,
 	UObjectLibrary* ObjectLibrary,
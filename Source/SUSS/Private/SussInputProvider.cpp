@@ -9,3 +9,187 @@ float USussInputProvider::Evaluate_Implementation(const class USussBrainComponen
 {
 	return 0;
 }
+
+void USussInputProvider::EvaluateBatch(const USussBrainComponent* Brain,
+	TConstArrayView<const FSussContext*> Contexts,
+	const TMap<FName, FSussParameter>& Parameters,
+	TArrayView<float> OutValues) const
+{
+	check(Contexts.Num() == OutValues.Num());
+
+	if (IsEvaluateImplementedInBlueprint())
+	{
+		for (int i = 0; i < Contexts.Num(); ++i)
+		{
+			OutValues[i] = Evaluate(Brain, *Contexts[i], Parameters);
+		}
+		return;
+	}
+
+	for (int i = 0; i < Contexts.Num(); ++i)
+	{
+		const bool bSameAsPrevious = i > 0 &&
+			(BatchDependency == ESussInputBatchDependency::None ||
+			(BatchDependency == ESussInputBatchDependency::Self && Contexts[i]->ControlledActor == Contexts[i - 1]->ControlledActor));
+		OutValues[i] = bSameAsPrevious ? OutValues[i - 1] : Evaluate_Implementation(Brain, *Contexts[i], Parameters);
+	}
+}
+
+bool USussInputProvider::IsEvaluateImplementedInBlueprint() const
+{
+	int8 bInBlueprint = EvaluateInBlueprint.load(std::memory_order_relaxed);
+	if (bInBlueprint < 0)
+	{
+		// Same answer on every thread, so racing to resolve it is harmless
+		bInBlueprint = GetClass()->IsFunctionImplementedInScript(GET_FUNCTION_NAME_CHECKED(USussInputProvider, Evaluate)) ? 1 : 0;
+		EvaluateInBlueprint.store(bInBlueprint, std::memory_order_relaxed);
+	}
+	return bInBlueprint != 0;
+}
+
+FSussInputContextKey USussInputProvider::MakeMemoKey(const FSussContext& Context) const
+{
+	switch (MemoScope)
+	{
+	case ESussInputMemoScope::Target:
+		return FSussInputContextKey(Context.Target.Get(), FVector::ZeroVector);
+	case ESussInputMemoScope::Location:
+		return FSussInputContextKey(nullptr, Context.Location);
+	default:
+	case ESussInputMemoScope::Global:
+		return FSussInputContextKey();
+	}
+}
+
+USussInputProvider::FMemoEntry& USussInputProvider::FindOrAddMemoEntry(const TMap<FName, FSussParameter>& Parameters,
+	uint32 ParamsHash) const
+{
+	if (MemoFrame != GFrameCounter)
+	{
+		// Values are only valid within a frame
+		MemoEntries.Reset();
+		MemoFrame = GFrameCounter;
+	}
+
+	for (auto& Entry : MemoEntries)
+	{
+		if (Entry.ParamsHash == ParamsHash && ParametersMatch(Entry.Parameters, Parameters))
+		{
+			return Entry;
+		}
+	}
+
+	FMemoEntry& Entry = MemoEntries.AddDefaulted_GetRef();
+	Entry.ParamsHash = ParamsHash;
+	Entry.Parameters = Parameters;
+	return Entry;
+}
+
+void USussInputProvider::EvaluateBatchMemoised(const USussBrainComponent* Brain,
+	TConstArrayView<const FSussContext*> Contexts,
+	const TMap<FName, FSussParameter>& Parameters,
+	TArrayView<float> OutValues) const
+{
+	if (MemoScope == ESussInputMemoScope::None)
+	{
+		EvaluateBatch(Brain, Contexts, Parameters, OutValues);
+		return;
+	}
+
+	check(Contexts.Num() == OutValues.Num());
+
+	const uint32 ParamsHash = HashParameters(Parameters);
+
+	// Scratch is local rather than a member, since other brains may be evaluating this input at the same time
+	TArray<const FSussContext*, TInlineAllocator<32>> MissContexts;
+	TArray<int, TInlineAllocator<32>> MissIndices;
+	{
+		FScopeLock Lock(&MemoGuard);
+		const FMemoEntry& Entry = FindOrAddMemoEntry(Parameters, ParamsHash);
+		for (int i = 0; i < Contexts.Num(); ++i)
+		{
+			if (const float* pValue = Entry.Values.Find(MakeMemoKey(*Contexts[i])))
+			{
+				OutValues[i] = *pValue;
+			}
+			else
+			{
+				MissContexts.Add(Contexts[i]);
+				MissIndices.Add(i);
+			}
+		}
+	}
+
+	if (MissContexts.IsEmpty())
+		return;
+
+	// Not locked while evaluating, inputs can evaluate other inputs
+	TArray<float, TInlineAllocator<32>> MissValues;
+	MissValues.AddUninitialized(MissContexts.Num());
+	EvaluateBatch(Brain, MissContexts, Parameters, MissValues);
+
+	FScopeLock Lock(&MemoGuard);
+	FMemoEntry& Entry = FindOrAddMemoEntry(Parameters, ParamsHash);
+	for (int m = 0; m < MissContexts.Num(); ++m)
+	{
+		OutValues[MissIndices[m]] = MissValues[m];
+		Entry.Values.Add(MakeMemoKey(*MissContexts[m]), MissValues[m]);
+	}
+}
+
+void USussInputProvider::InvalidateMemo() const
+{
+	FScopeLock Lock(&MemoGuard);
+	MemoEntries.Reset();
+}
+
+FSussInputContextKey USussInputProvider::MakeCacheKey(const FSussContext& Context) const
+{
+	switch (CacheKey)
+	{
+	case ESussInputCacheKey::Target:
+		return FSussInputContextKey(Context.Target.Get(), FVector::ZeroVector);
+	case ESussInputCacheKey::Location:
+		return FSussInputContextKey(nullptr, Context.Location);
+	case ESussInputCacheKey::TargetAndLocation:
+		return FSussInputContextKey(Context.Target.Get(), Context.Location);
+	default:
+	case ESussInputCacheKey::Self:
+		return FSussInputContextKey();
+	}
+}
+
+float USussInputProvider::GetCacheHitRate() const
+{
+	const uint64 Hits = GetCacheHits();
+	const uint64 Total = Hits + GetCacheMisses();
+	return Total > 0 ? (double)Hits / Total : 0;
+}
+
+uint32 USussInputProvider::HashParameters(const TMap<FName, FSussParameter>& Parameters)
+{
+	uint32 Hash = 0;
+	for (const auto& Pair : Parameters)
+	{
+		Hash = HashCombine(Hash, GetTypeHash(Pair.Key));
+		Hash = HashCombine(Hash, GetTypeHash(Pair.Value));
+	}
+	return Hash;
+}
+
+bool USussInputProvider::ParametersMatch(const TMap<FName, FSussParameter>& Params1,
+	const TMap<FName, FSussParameter>& Params2)
+{
+	if (Params1.Num() != Params2.Num())
+		return false;
+
+	for (const auto& Pair : Params1)
+	{
+		const FSussParameter* pParam2 = Params2.Find(Pair.Key);
+		if (!pParam2 || Pair.Value != *pParam2)
+		{
+			return false;
+		}
+	}
+	return true;
+}
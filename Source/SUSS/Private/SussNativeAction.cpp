@@ -0,0 +1,40 @@
+﻿#include "SussNativeAction.h"
+
+#include "SussBrainComponent.h"
+
+UWorld* FSussNativeAction::GetWorld() const
+{
+	return IsValid(Brain) ? Brain->GetWorld() : nullptr;
+}
+
+void FSussNativeAction::ActionCompleted()
+{
+	if (IsValid(Brain))
+	{
+		Brain->OnNativeActionCompleted(this);
+	}
+}
+
+void FSussNativeAction::SetTemporaryActionScoreAdjustment(float Value, float CooldownTime)
+{
+	if (IsValid(Brain))
+	{
+		Brain->SetTemporaryActionScoreAdjustment(BrainActionIndex, Value, CooldownTime);
+	}
+}
+
+void FSussNativeAction::AddTemporaryScoreAdjustment(float Value, float CooldownTime)
+{
+	if (IsValid(Brain))
+	{
+		Brain->AddTemporaryActionScoreAdjustment(BrainActionIndex, Value, CooldownTime);
+	}
+}
+
+void FSussNativeAction::ResetTemporaryScoreAdjustment()
+{
+	if (IsValid(Brain))
+	{
+		Brain->ResetTemporaryActionScoreAdjustment(BrainActionIndex);
+	}
+}
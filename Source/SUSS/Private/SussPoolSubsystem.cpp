@@ -4,10 +4,27 @@
 #include "SussPoolSubsystem.h"
 
 #include "SussAction.h"
+#include "SussActionSetAsset.h"
+#include "SussBrainConfigAsset.h"
+#include "SussGameSubsystem.h"
 #include "SussCommon.h"
+#include "SussSettings.h"
 
-FSussScopeReservedArray::~FSussScopeReservedArray()
+namespace
 {
+	// Ids of pools which haven't been deinitialized, so threads can drop their cache entries for pools which have
+	FCriticalSection GSussLivePoolIdsGuard;
+	TSet<uint32> GSussLivePoolIds;
+	// Bumped every time a pool is deinitialized, so threads know to re-check their cache entries
+	std::atomic<uint32> GSussPoolGeneration { 0 };
+}
+
+void FSussScopeReservedArray::Free()
+{
+	if (!bOwnsHolder)
+		return;
+
+	bOwnsHolder = false;
 	if (OwningSystem.IsValid())
 	{
 		OwningSystem->FreeArray(Holder);
@@ -19,8 +36,12 @@ FSussScopeReservedArray::~FSussScopeReservedArray()
 	}
 }
 
-FSussScopeReservedMap::~FSussScopeReservedMap()
+void FSussScopeReservedMap::Free()
 {
+	if (!bOwnsHolder)
+		return;
+
+	bOwnsHolder = false;
 	if (OwningSystem.IsValid())
 	{
 		OwningSystem->FreeMap(Holder);
@@ -32,69 +53,288 @@ FSussScopeReservedMap::~FSussScopeReservedMap()
 	}
 }
 
-TSussReservedActionPtr USussPoolSubsystem::ReserveAction(UClass* ActionClass,
-                                                         UObject* TemplateIfCreated)
+void USussPoolSubsystem::Initialize(FSubsystemCollectionBase& Collection)
 {
-	FScopeLock Lock(&Guard);
+	Super::Initialize(Collection);
 
-	USussAction* Ret = nullptr;
-	if (auto FreeList = FreeActionClassPools.Find(ActionClass))
+	static std::atomic<uint32> NextPoolId { 1 };
+	PoolId = NextPoolId++;
 	{
-		if (FreeList->Pool.Num() > 0)
+		FScopeLock Lock(&GSussLivePoolIdsGuard);
+		GSussLivePoolIds.Add(PoolId);
+	}
+
+	Collection.InitializeDependency<USussGameSubsystem>();
+	PostLoadMapHandle = FCoreUObjectDelegates::PostLoadMapWithWorld.AddUObject(this, &USussPoolSubsystem::OnPostLoadMap);
+}
+
+void USussPoolSubsystem::OnPostLoadMap(UWorld* World)
+{
+	// Pre-warm anything listed in settings; brains pre-warm their own actions as they're spawned
+	auto Settings = GetDefault<USussSettings>();
+	for (const auto& ConfigPtr : Settings->PrewarmBrainConfigs)
+	{
+		if (const auto Config = ConfigPtr.LoadSynchronous())
 		{
-			Ret = FreeList->Pool.Pop();
+			PrewarmActions(Config->BrainConfig, Settings->ActionPrewarmCountPerClass);
+		}
+	}
+	for (const auto& ActionSetPtr : Settings->PrewarmActionSets)
+	{
+		if (const auto ActionSet = ActionSetPtr.LoadSynchronous())
+		{
+			PrewarmActions(ActionSet->GetActions(), Settings->ActionPrewarmCountPerClass);
 		}
 	}
+}
 
-	if (!Ret)
+void USussPoolSubsystem::PrewarmAction(UClass* ActionClass, int Count)
+{
+	if (!ActionClass || Count <= 0)
+		return;
+
+	FScopeLock Lock(&ActionGuard);
+	int& Wanted = PendingActionPrewarms.FindOrAdd(ActionClass);
+	Wanted = FMath::Max(Wanted, Count);
+}
+
+void USussPoolSubsystem::PrewarmActions(const TArray<FSussActionDef>& Actions, int CountPerClass)
+{
+	auto SUSS = GetGameInstance()->GetSubsystem<USussGameSubsystem>();
+	if (!SUSS)
+		return;
+
+	for (const auto& Def : Actions)
 	{
-		Ret = NewObject<USussAction>(this, ActionClass, NAME_None, RF_NoFlags, TemplateIfCreated);
+		// Native actions aren't pooled
+		if (!SUSS->GetNativeActionFactory(Def.ActionTag))
+		{
+			PrewarmAction(SUSS->GetActionClass(Def.ActionTag), CountPerClass);
+		}
 	}
+}
 
-	auto ReserveList = ReservedActionClassPools.Find(ActionClass);
-	if (!ReserveList)
+void USussPoolSubsystem::PrewarmActions(const FSussBrainConfig& Config, int CountPerClass)
+{
+	for (const auto ActionSet : Config.ActionSets)
 	{
-		ReserveList = &ReservedActionClassPools.Emplace(ActionClass);
+		if (IsValid(ActionSet))
+		{
+			PrewarmActions(ActionSet->GetActions(), CountPerClass);
+		}
 	}
-	ReserveList->Pool.Push(Ret);
+	PrewarmActions(Config.ActionDefs, CountPerClass);
+}
 
-	//UE_LOG(LogTemp, Warning, TEXT("Reserved action: %s"), *Ret->GetName())
+void USussPoolSubsystem::ProcessActionPrewarms()
+{
+	FScopeLock Lock(&ActionGuard);
 
-	// return a shared ptr which doesn't delete, it frees the reserved action
-	// Use WeakPtr to guard against shutdown issues
-	TWeakObjectPtr<USussPoolSubsystem> WeakThis(this);
-	return TSussReservedActionPtr(Ret, [WeakThis](USussAction* Obj)
+	int Budget = GetDefault<USussSettings>()->ActionPrewarmMaxPerFrame;
+	for (auto It = PendingActionPrewarms.CreateIterator(); It && Budget > 0; ++It)
 	{
-		if (Obj && WeakThis.IsValid()) 
+		UClass* ActionClass = It.Key();
+		if (!IsValid(ActionClass))
+		{
+			It.RemoveCurrent();
+			continue;
+		}
+
+		// Instances already in use count towards the total
+		auto& FreeList = FreeActionClassPools.FindOrAdd(ActionClass);
+		int Existing = FreeList.Pool.Num() + NumReservedActionsByClass.FindRef(ActionClass);
+		for (; Existing < It.Value() && Budget > 0; ++Existing, --Budget)
 		{
-			WeakThis->InternalFreeAction(Obj);
+			// Same as ReserveAction, constructed from the default object to support BP classes
+			FreeList.Pool.Push(NewObject<USussAction>(this, ActionClass, NAME_None, RF_NoFlags, ActionClass->GetDefaultObject()));
 		}
-	});
 
+		if (Existing >= It.Value())
+		{
+			It.RemoveCurrent();
+		}
+	}
 }
 
-void USussPoolSubsystem::InternalFreeAction(USussAction* Action)
+FSussPoolThreadCache& USussPoolSubsystem::GetThreadCache()
 {
-	FScopeLock Lock(&Guard);
+	// Each thread remembers its cache for each pool (more than one pool with PIE). Pool ids are never re-used, but
+	// caches are destroyed with their pool, so entries are re-validated whenever any pool has been deinitialized
+	struct FThreadCacheEntries
+	{
+		uint32 PoolGeneration = 0;
+		TArray<TPair<uint32, FSussPoolThreadCache*>, TInlineAllocator<4>> Entries;
+	};
+	static thread_local FThreadCacheEntries CachesForThisThread;
 
-	if (!Action)
+	const uint32 PoolGeneration = GSussPoolGeneration.load(std::memory_order_acquire);
+	if (CachesForThisThread.PoolGeneration != PoolGeneration)
+	{
+		FScopeLock Lock(&GSussLivePoolIdsGuard);
+		CachesForThisThread.Entries.RemoveAll([](const TPair<uint32, FSussPoolThreadCache*>& Pair)
+		{
+			return !GSussLivePoolIds.Contains(Pair.Key);
+		});
+		CachesForThisThread.PoolGeneration = PoolGeneration;
+	}
+
+	for (const auto& Pair : CachesForThisThread.Entries)
+	{
+		if (Pair.Key == PoolId)
+		{
+			return *Pair.Value;
+		}
+	}
+
+	FSussPoolThreadCache* Cache;
+	{
+		FScopeLock Lock(&ThreadCacheGuard);
+		Cache = ThreadCaches.Add_GetRef(MakeUnique<FSussPoolThreadCache>()).Get();
+		Cache->PoolId = PoolId;
+	}
+
+	// Never evict entries for live pools, that would strand their free containers & add a new cache every time
+	CachesForThisThread.Entries.Add(TPair<uint32, FSussPoolThreadCache*>(PoolId, Cache));
+	return *Cache;
+}
+
+void FSussPoolTypeStats::RecordReserve()
+{
+	const int32 Outstanding = ++NumOutstanding;
+
+	int32 Prev = HighWaterOutstanding.load();
+	while (Outstanding > Prev && !HighWaterOutstanding.compare_exchange_weak(Prev, Outstanding)) {}
+	Prev = PeakOutstandingSinceTrim.load();
+	while (Outstanding > Prev && !PeakOutstandingSinceTrim.compare_exchange_weak(Prev, Outstanding)) {}
+}
+
+void FSussPoolTypeStats::RecordFree(SIZE_T AllocatedBytes)
+{
+	--NumOutstanding;
+
+	int64 Prev = HighWaterBytes.load();
+	while ((int64)AllocatedBytes > Prev && !HighWaterBytes.compare_exchange_weak(Prev, (int64)AllocatedBytes)) {}
+	++CapacityHistogram[GetHistogramBucket(AllocatedBytes)];
+}
+
+int FSussPoolTypeStats::GetHistogramBucket(SIZE_T AllocatedBytes)
+{
+	// Bucket 0 is < 64 bytes, 1 is < 128 etc
+	const int Bucket = AllocatedBytes < 64 ? 0 : (int)FMath::FloorLog2_64(AllocatedBytes) - 5;
+	return FMath::Min(Bucket, NumHistogramBuckets - 1);
+}
+
+void USussPoolSubsystem::FreeArray(const FSussPooledArrayPtr& Holder)
+{
+	FSussPooledArrayPtr H = Holder;
+	ArrayStats[H.GetTypeIndex()].RecordFree(H.GetAllocatedSize());
+	if (bDeinitialized)
+	{
+		// Free lists have already been destroyed
+		H.Destroy();
 		return;
+	}
 
-	//UE_LOG(LogTemp, Warning, TEXT("Freed action: %s"), *Action->GetName())
-	
-	auto FreeList = FreeActionClassPools.Find(Action->GetClass());
-	if (!FreeList)
+	H.Reset();
+	const SIZE_T TypeIndex = H.GetTypeIndex();
+	auto& ThreadFree = GetThreadCache().FreeArrays[TypeIndex];
+	if (ThreadFree.Num() < FSussPoolThreadCache::MaxPerType)
 	{
-		FreeList = &FreeActionClassPools.Emplace(Action->GetClass());
+		ThreadFree.Push(H);
+		return;
 	}
-	FreeList->Pool.Push(Action);
 
-	// Remove from reserve
-	if (auto ReserveList = ReservedActionClassPools.Find(Action->GetClass()))
+	FScopeLock Lock(&ArrayGuard);
+	FreeArrayPools[TypeIndex].Push(H);
+}
+
+void USussPoolSubsystem::FreeMap(const FSussPooledMapPtr& Holder)
+{
+	FSussPooledMapPtr H = Holder;
+	MapStats[H.GetTypeIndex()].RecordFree(H.GetAllocatedSize());
+	if (bDeinitialized)
 	{
-		ReserveList->Pool.Remove(Action);
+		// Free lists have already been destroyed
+		H.Destroy();
+		return;
+	}
+
+	H.Reset();
+	const SIZE_T TypeIndex = H.GetTypeIndex();
+	auto& ThreadFree = GetThreadCache().FreeMaps[TypeIndex];
+	if (ThreadFree.Num() < FSussPoolThreadCache::MaxPerType)
+	{
+		ThreadFree.Push(H);
+		return;
 	}
 
+	FScopeLock Lock(&MapGuard);
+	FreeMapPools[TypeIndex].Push(H);
+}
+
+void FSussReservedActionHandle::Reset()
+{
+	if (Action)
+	{
+		if (Pool.IsValid())
+		{
+			Pool->InternalFreeAction(SlotIndex, Generation);
+		}
+		Action = nullptr;
+		SlotIndex = INDEX_NONE;
+	}
+}
+
+FSussReservedActionHandle USussPoolSubsystem::ReserveAction(UClass* ActionClass,
+                                                            UObject* TemplateIfCreated)
+{
+	FScopeLock Lock(&ActionGuard);
+
+	USussAction* Ret = nullptr;
+	if (auto FreeList = FreeActionClassPools.Find(ActionClass))
+	{
+		if (FreeList->Pool.Num() > 0)
+		{
+			Ret = FreeList->Pool.Pop();
+		}
+	}
+
+	if (!Ret)
+	{
+		Ret = NewObject<USussAction>(this, ActionClass, NAME_None, RF_NoFlags, TemplateIfCreated);
+	}
+
+	const int32 SlotIndex = FreeReservedActionSlots.Num() > 0 ? FreeReservedActionSlots.Pop() : ReservedActionSlots.AddDefaulted();
+	FSussReservedActionSlot& Slot = ReservedActionSlots[SlotIndex];
+	Slot.Action = Ret;
+	++NumReservedActionsByClass.FindOrAdd(ActionClass);
+
+	//UE_LOG(LogTemp, Warning, TEXT("Reserved action: %s"), *Ret->GetName())
+
+	return FSussReservedActionHandle(Ret, this, SlotIndex, Slot.Generation);
+}
+
+void USussPoolSubsystem::InternalFreeAction(int32 SlotIndex, uint32 Generation)
+{
+	FScopeLock Lock(&ActionGuard);
+
+	// Ignore stale handles, e.g. reservations from before Deinitialize
+	if (!ReservedActionSlots.IsValidIndex(SlotIndex))
+		return;
+	FSussReservedActionSlot& Slot = ReservedActionSlots[SlotIndex];
+	if (Slot.Generation != Generation || !Slot.Action)
+		return;
+
+	USussAction* Action = Slot.Action;
+	Slot.Action = nullptr;
+	++Slot.Generation;
+	FreeReservedActionSlots.Push(SlotIndex);
+	--NumReservedActionsByClass.FindOrAdd(Action->GetClass());
+
+	//UE_LOG(LogTemp, Warning, TEXT("Freed action: %s"), *Action->GetName())
+	
+	FreeActionClassPools.FindOrAdd(Action->GetClass()).Pool.Push(Action);
+
 	// Unbind any callback if back to pool
 	Action->InternalOnActionCompleted.Unbind();
 }
@@ -103,20 +343,176 @@ void USussPoolSubsystem::Deinitialize()
 {
 	Super::Deinitialize();
 
-	FScopeLock Lock(&Guard);
+	FCoreUObjectDelegates::PostLoadMapWithWorld.Remove(PostLoadMapHandle);
 
-	// Deallocate anything left
-	for (auto& H : FreeArrayPools)
+	FScopeLock ArrayLock(&ArrayGuard);
+	FScopeLock MapLock(&MapGuard);
+	FScopeLock ActionLock(&ActionGuard);
+	FScopeLock ThreadCacheLock(&ThreadCacheGuard);
+
+	bDeinitialized = true;
 	{
-		H.Destroy();
+		FScopeLock Lock(&GSussLivePoolIdsGuard);
+		GSussLivePoolIds.Remove(PoolId);
+		// Thread caches are destroyed below, threads must drop their pointers to them
+		++GSussPoolGeneration;
 	}
-	FreeArrayPools.Empty();
-	
-	for (auto& H : FreeMapPools)
+
+	// Deallocate anything left, both shared and in thread caches
+	const auto DestroyAll = [](auto& FreeList)
 	{
-		H.Destroy();
+		for (auto& H : FreeList)
+		{
+			H.Destroy();
+		}
+		FreeList.Empty();
+	};
+	for (auto& FreeList : FreeArrayPools)
+	{
+		DestroyAll(FreeList);
+	}
+	for (auto& FreeList : FreeMapPools)
+	{
+		DestroyAll(FreeList);
+	}
+	for (auto& Cache : ThreadCaches)
+	{
+		for (auto& FreeList : Cache->FreeArrays)
+		{
+			DestroyAll(FreeList);
+		}
+		for (auto& FreeList : Cache->FreeMaps)
+		{
+			DestroyAll(FreeList);
+		}
 	}
-	FreeMapPools.Empty();
+	ThreadCaches.Empty();
 
 	FreeActionClassPools.Empty();
+	ReservedActionSlots.Empty();
+	FreeReservedActionSlots.Empty();
+	NumReservedActionsByClass.Empty();
+}
+
+TStatId USussPoolSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(USussPoolSubsystem, STATGROUP_SUSS);
+}
+
+UWorld* USussPoolSubsystem::GetTickableGameObjectWorld() const
+{
+	return GetWorld();
+}
+
+void USussPoolSubsystem::Tick(float DeltaTime)
+{
+	if (PendingActionPrewarms.Num() > 0)
+	{
+		ProcessActionPrewarms();
+	}
+
+	TimeSinceTrim += DeltaTime;
+	if (TimeSinceTrim >= GetDefault<USussSettings>()->PoolTrimIntervalSeconds)
+	{
+		TimeSinceTrim = 0;
+		TrimFreeLists();
+	}
+}
+
+namespace
+{
+	/// Destroy free containers beyond those needed to cover the peak reserved since the last trim. Returns bytes still held
+	template<typename THolder, SIZE_T N>
+	int64 TrimExcessFree(TArray<THolder> (&FreeLists)[N], FSussPoolTypeStats (&Stats)[N])
+	{
+		int64 TotalBytes = 0;
+		for (SIZE_T i = 0; i < N; ++i)
+		{
+			auto& FreeList = FreeLists[i];
+			const int32 Outstanding = Stats[i].NumOutstanding.load();
+			const int32 Peak = Stats[i].PeakOutstandingSinceTrim.exchange(Outstanding);
+			const int32 NumToKeep = FMath::Max(Peak - Outstanding, 0);
+			while (FreeList.Num() > NumToKeep)
+			{
+				FreeList.Pop().Destroy();
+			}
+			FreeList.Shrink();
+
+			for (const auto& H : FreeList)
+			{
+				TotalBytes += H.GetAllocatedSize();
+			}
+		}
+		return TotalBytes;
+	}
+
+	template<typename THolder, SIZE_T N>
+	void GatherFree(TArray<THolder> (&FreeLists)[N], TArray<TPair<SIZE_T, const THolder*>>& OutBySize)
+	{
+		for (const auto& FreeList : FreeLists)
+		{
+			for (const auto& H : FreeList)
+			{
+				OutBySize.Add(TPair<SIZE_T, const THolder*>(H.GetAllocatedSize(), &H));
+			}
+		}
+	}
+}
+
+DECLARE_CYCLE_STAT(TEXT("SUSS Pool Trim"), STAT_SUSS_PoolTrim, STATGROUP_SUSS);
+
+void USussPoolSubsystem::TrimFreeLists()
+{
+	SCOPE_CYCLE_COUNTER(STAT_SUSS_PoolTrim);
+
+	FScopeLock ArrayLock(&ArrayGuard);
+	FScopeLock MapLock(&MapGuard);
+
+	// Other threads' caches can't be touched without them knowing, but this thread's can be moved to the shared lists
+	FSussPoolThreadCache& ThreadCache = GetThreadCache();
+	for (SIZE_T i = 0; i < FSussPooledArrayPtr::NumTypes; ++i)
+	{
+		FreeArrayPools[i].Append(ThreadCache.FreeArrays[i]);
+		ThreadCache.FreeArrays[i].Reset();
+	}
+	for (SIZE_T i = 0; i < FSussPooledMapPtr::NumTypes; ++i)
+	{
+		FreeMapPools[i].Append(ThreadCache.FreeMaps[i]);
+		ThreadCache.FreeMaps[i].Reset();
+	}
+
+	int64 FreeBytes = TrimExcessFree(FreeArrayPools, ArrayStats) + TrimExcessFree(FreeMapPools, MapStats);
+
+	const int64 CapBytes = (int64)GetDefault<USussSettings>()->PoolFreeMemoryCapKilobytes * 1024;
+	if (FreeBytes > CapBytes)
+	{
+		// Release the largest buffers first, they're the ones left over from unusual spikes
+		TArray<TPair<SIZE_T, const FSussPooledArrayPtr*>> ArraysBySize;
+		TArray<TPair<SIZE_T, const FSussPooledMapPtr*>> MapsBySize;
+		GatherFree(FreeArrayPools, ArraysBySize);
+		GatherFree(FreeMapPools, MapsBySize);
+		ArraysBySize.Sort([](const auto& A, const auto& B) { return A.Key > B.Key; });
+		MapsBySize.Sort([](const auto& A, const auto& B) { return A.Key > B.Key; });
+
+		int ArrayIdx = 0, MapIdx = 0;
+		while (FreeBytes > CapBytes && (ArrayIdx < ArraysBySize.Num() || MapIdx < MapsBySize.Num()))
+		{
+			const bool bArrayNext = MapIdx >= MapsBySize.Num() ||
+				(ArrayIdx < ArraysBySize.Num() && ArraysBySize[ArrayIdx].Key >= MapsBySize[MapIdx].Key);
+			if (bArrayNext)
+			{
+				const auto& Entry = ArraysBySize[ArrayIdx++];
+				Entry.Value->Trim();
+				FreeBytes -= Entry.Key - Entry.Value->GetAllocatedSize();
+			}
+			else
+			{
+				const auto& Entry = MapsBySize[MapIdx++];
+				Entry.Value->Trim();
+				FreeBytes -= Entry.Key - Entry.Value->GetAllocatedSize();
+			}
+		}
+	}
+
+	UE_LOG(LogSuss, Verbose, TEXT("SUSS pool trimmed, %lld bytes held in free containers"), FreeBytes);
 }
@@ -2,12 +2,28 @@
 
 #include "SussCommon.h"
 
+namespace
+{
+	// Per thread rather than per provider, since the same provider can be executing for different keys concurrently
+	thread_local TArray<FSussContextValue>* GSussNamedValueOutArray = nullptr;
+}
+
+FIntVector USussQueryProvider::GetSpatialCell(AActor* Self) const
+{
+	if (!IsValid(Self))
+		return FIntVector::ZeroValue;
+
+	const FVector Pos = Self->GetActorLocation() / FMath::Max(SpatialCellSize, 1.0f);
+	return FIntVector(FMath::FloorToInt(Pos.X), FMath::FloorToInt(Pos.Y), FMath::FloorToInt(Pos.Z));
+}
 
 uint32 USussQueryProvider::HashQueryRequest(AActor* Self, const TMap<FName, FSussParameter>& Params)
 {
 	uint32 Hash = 0;
 
-	if (bSelfIsRelevant)
+	if (IsSharingResultsSpatially())
+		Hash = GetTypeHash(GetSpatialCell(Self));
+	else if (bSelfIsRelevant)
 		Hash = GetTypeHash(Self);
 	
 	for (const auto& Pair : Params)
@@ -41,6 +57,105 @@ bool USussQueryProvider::ParamsMatch(const TMap<FName, FSussParameter>& Params1,
 	return true;
 }
 
+bool USussQueryProvider::ResultsMatch(const TSussResultsArray& Results1, const TSussResultsArray& Results2)
+{
+	if (Results1.GetIndex() != Results2.GetIndex())
+		return false;
+
+	return Visit([&Results2](const auto& Array1)
+	{
+		using ArrayType = std::decay_t<decltype(Array1)>;
+		return Array1 == Results2.Get<ArrayType>();
+	}, Results1);
+}
+
+void USussQueryProvider::InvalidateCachedResults(AActor* Self)
+{
+	const bool bSpatial = IsSharingResultsSpatially();
+	const FIntVector Cell = bSpatial ? GetSpatialCell(Self) : FIntVector::ZeroValue;
+
+	// Only look at the entries owned by Self; pinned so they're not locked while holding the index lock
+	TArray<TSussCachedQueryResultsRef, TInlineAllocator<8>> Entries;
+	{
+		FScopeLock IndexLock(&EntryIndexGuard);
+		const TSussCachedQueryResultsWeakList* pList = bSpatial ? EntriesByCell.Find(Cell) : EntriesByOwner.Find(TObjectKey<AActor>(Self));
+		if (!pList)
+			return;
+
+		for (const auto& WeakEntry : *pList)
+		{
+			if (const TSussCachedQueryResultsPtr Entry = WeakEntry.Pin())
+			{
+				Entries.Add(Entry.ToSharedRef());
+			}
+		}
+	}
+
+	for (const auto& Entry : Entries)
+	{
+		FScopeLock EntryLock(&Entry->ExecutionGuard);
+		// Someone else may have run it since we looked in the index
+		const bool bOwned = bSpatial ? Entry->SpatialCell == Cell : Entry->ControlledActor.Get() == Self;
+		if (bOwned)
+		{
+			// Results are kept so the version only changes if the next run produces something different
+			Entry->TimeSinceLastRun = UE_BIG_NUMBER;
+		}
+	}
+}
+
+void USussQueryProvider::IndexCacheEntry(FSussCachedQueryResults& Entry)
+{
+	const bool bSpatial = IsSharingResultsSpatially();
+	const TObjectKey<AActor> Owner(Entry.ControlledActor.Get());
+	if (Entry.bIndexed && (bSpatial ? Entry.IndexedCell == Entry.SpatialCell : Entry.IndexedOwner == Owner))
+	{
+		// Usual case, still run for the same owner / cell
+		return;
+	}
+
+	FScopeLock IndexLock(&EntryIndexGuard);
+	const auto IsEntry = [&Entry](const TWeakPtr<FSussCachedQueryResults, ESPMode::ThreadSafe>& WeakEntry)
+	{
+		return WeakEntry.HasSameObject(&Entry);
+	};
+	if (Entry.bIndexed)
+	{
+		if (auto pOldList = bSpatial ? EntriesByCell.Find(Entry.IndexedCell) : EntriesByOwner.Find(Entry.IndexedOwner))
+		{
+			pOldList->RemoveAllSwap(IsEntry);
+		}
+	}
+
+	auto& NewList = bSpatial ? EntriesByCell.FindOrAdd(Entry.SpatialCell) : EntriesByOwner.FindOrAdd(Owner);
+	NewList.Add(Entry.AsShared());
+	Entry.IndexedOwner = Owner;
+	Entry.IndexedCell = Entry.SpatialCell;
+	Entry.bIndexed = true;
+}
+
+void USussQueryProvider::PruneCacheEntryIndex()
+{
+	FScopeLock IndexLock(&EntryIndexGuard);
+
+	const auto Prune = [](auto& EntriesByKey)
+	{
+		for (auto It = EntriesByKey.CreateIterator(); It; ++It)
+		{
+			It->Value.RemoveAllSwap([](const TWeakPtr<FSussCachedQueryResults, ESPMode::ThreadSafe>& WeakEntry)
+			{
+				return !WeakEntry.IsValid();
+			});
+			if (It->Value.Num() == 0)
+			{
+				It.RemoveCurrent();
+			}
+		}
+	};
+	Prune(EntriesByOwner);
+	Prune(EntriesByCell);
+}
+
 void USussTargetQueryProvider::ExecuteQuery(USussBrainComponent* Brain,
                                             AActor* Self,
                                             const TMap<FName, FSussParameter>& Params,
@@ -63,9 +178,21 @@ void USussLocationQueryProvider::ExecuteQuery(USussBrainComponent* Brain,
 	ExecuteQueryBP(Brain, Self, Params, Context, OutResults);
 }
 
+void USussNamedValueQueryProvider::AddValue(const FSussContextValue& Value)
+{
+	if (GSussNamedValueOutArray)
+	{
+		GSussNamedValueOutArray->Add(Value);
+	}
+	else
+	{
+		UE_LOG(LogSuss, Error, TEXT("%s: named values can only be added while executing the query"), *GetClass()->GetName());
+	}
+}
+
 void USussNamedValueQueryProvider::AddValueStruct(const TSharedPtr<const FSussContextValueStructBase>& Struct)
 {
-	TempOutArray->Add(FSussContextValue(Struct));
+	AddValue(FSussContextValue(Struct));
 }
 
 void USussNamedValueQueryProvider::AddValueStruct(const FSussContextValueStructBase* Struct)
@@ -74,7 +201,7 @@ void USussNamedValueQueryProvider::AddValueStruct(const FSussContextValueStructB
 	{
 		UE_LOG(LogSuss, Warning, TEXT("%s uses raw pointers AND cacheing together, this is dangerous! Either set bUseCachedResults=false or bDisableRawPointerCacheWarning=true"), *StaticClass()->GetName());
 	}
-	TempOutArray->Add(FSussContextValue(Struct));
+	AddValue(FSussContextValue(Struct));
 }
 
 void USussNamedValueQueryProvider::ExecuteQuery(USussBrainComponent* Brain,
@@ -89,5 +216,16 @@ void USussNamedValueQueryProvider::ExecuteQuery(USussBrainComponent* Brain,
 	ExecuteQueryBP(Brain, Self, Params, Context);
 }
 
+void USussNamedValueQueryProvider::ExecuteQueryWithOutArray(USussBrainComponent* Brain,
+	AActor* Self,
+	const TMap<FName, FSussParameter>& Params,
+	const FSussContext& Context,
+	TArray<FSussContextValue>& OutResults)
+{
+	// Guarded rather than cleared so that a query run from inside another query's BP restores the outer array
+	TGuardValue<TArray<FSussContextValue>*> OutArrayGuard(GSussNamedValueOutArray, &OutResults);
+	ExecuteQuery(Brain, Self, Params, Context, OutResults);
+}
+
 
 
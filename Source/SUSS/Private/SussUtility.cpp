@@ -571,7 +571,7 @@ bool USussUtility::GetSussContextValueAsTag(const FSussContext& Context, FName N
 	return false;
 }
 
-const TArray<FVector>& USussUtility::RunLocationQuery(AActor* Querier, FGameplayTag Tag, const TMap<FName, FSussParameter>& Params, float UseCachedResultsFor)
+TArray<FVector> USussUtility::RunLocationQuery(AActor* Querier, FGameplayTag Tag, const TMap<FName, FSussParameter>& Params, float UseCachedResultsFor)
 {
 	if (IsValid(Querier))
 	{
@@ -581,17 +581,18 @@ const TArray<FVector>& USussUtility::RunLocationQuery(AActor* Querier, FGameplay
 			{
 				if (Provider && Provider->GetProvidedContextElement() == ESussQueryContextElement::Location)
 				{
-					return Provider->GetResults<FVector>(nullptr, Querier, UseCachedResultsFor, Params);
+					TArray<FVector> Results;
+					Provider->GetResults<FVector>(nullptr, Querier, UseCachedResultsFor, Params, Results);
+					return Results;
 				}
 			}
 		}
 	}
 
-	static TArray<FVector> DummyResults;
-	return DummyResults;
+	return TArray<FVector>();
 }
 
-const TArray<FVector>& USussUtility::RunLocationQueryWithTargetContext(AActor* Querier,
+TArray<FVector> USussUtility::RunLocationQueryWithTargetContext(AActor* Querier,
 	FGameplayTag Tag,
 	AActor* Target,
 	const TMap<FName, FSussParameter>& Params,
@@ -607,7 +608,7 @@ const TArray<FVector>& USussUtility::RunLocationQueryWithTargetContext(AActor* Q
 			EQSSub->SetTargetInfo(Querier, Target);
 		}
 
-		const TArray<FVector>& Ret =RunLocationQuery(Querier, Tag, Params, UseCachedResultsFor);
+		TArray<FVector> Ret = RunLocationQuery(Querier, Tag, Params, UseCachedResultsFor);
 
 		// Clear temp context info
 		EQSSub->ClearTargetInfo(Querier);
@@ -615,8 +616,7 @@ const TArray<FVector>& USussUtility::RunLocationQueryWithTargetContext(AActor* Q
 		return Ret;
 	}
 
-	static TArray<FVector> DummyResults;
-	return DummyResults;
+	return TArray<FVector>();
 
 }
 
@@ -636,11 +636,13 @@ TArray<AActor*> USussUtility::RunTargetQuery(AActor* Querier,
 			{
 				if (Provider && Provider->GetProvidedContextElement() == ESussQueryContextElement::Target)
 				{
-					const auto& WeakResults = Provider->GetResults<TWeakObjectPtr<AActor>>(
-						nullptr,
-						Querier,
-						UseCachedResultsFor,
-						Params);
+					TArray<TWeakObjectPtr<AActor>> WeakResults;
+					Provider->GetResults<TWeakObjectPtr<AActor>>(nullptr,
+					                                             Querier,
+					                                             UseCachedResultsFor,
+					                                             Params,
+					                                             WeakResults);
+					Provider->FilterResultsForRequester(nullptr, Querier, Params, WeakResults);
 					for (auto WeakActor : WeakResults)
 					{
 						if (WeakActor.IsValid())
@@ -712,6 +714,155 @@ float USussUtility::EvalCurve(ESussCurveType CurveType, float Input, const FVect
 	return 0;
 }
 
+/// Batch curve kernels, one per curve type so the choice of curve is made at compile time rather than per value.
+/// Each evaluates 4 values at a time with vector intrinsics where the curve params allow it, otherwise falls back to
+/// the scalar versions (e.g. pow() of a negative base can't be done via exp2/log2).
+template<ESussCurveType Type> struct TSussCurveKernel;
+
+template<> struct TSussCurveKernel<ESussCurveType::Step>
+{
+	VectorRegister4Float M2, B, C;
+	explicit TSussCurveKernel(const FVector4f& Params)
+		: M2(VectorSetFloat1(PARAM_M * 2.f)), B(VectorSetFloat1(PARAM_B)), C(VectorSetFloat1(PARAM_C)) {}
+
+	static bool CanVectorise(const FVector4f& Params) { return true; }
+	static float EvalScalar(float Input, const FVector4f& Params) { return USussUtility::EvalStepCurve(Input, Params); }
+	FORCEINLINE VectorRegister4Float Eval(const VectorRegister4Float& X) const
+	{
+		// floor((x - c) * m * 2) + b
+		return VectorAdd(VectorFloor(VectorMultiply(VectorSubtract(X, C), M2)), B);
+	}
+};
+
+template<> struct TSussCurveKernel<ESussCurveType::Linear>
+{
+	VectorRegister4Float M, B, C;
+	explicit TSussCurveKernel(const FVector4f& Params)
+		: M(VectorSetFloat1(PARAM_M)), B(VectorSetFloat1(PARAM_B)), C(VectorSetFloat1(PARAM_C)) {}
+
+	static bool CanVectorise(const FVector4f& Params) { return true; }
+	static float EvalScalar(float Input, const FVector4f& Params) { return USussUtility::EvalLinearCurve(Input, Params); }
+	FORCEINLINE VectorRegister4Float Eval(const VectorRegister4Float& X) const
+	{
+		// m * (x - c) + b
+		return VectorMultiplyAdd(M, VectorSubtract(X, C), B);
+	}
+};
+
+template<> struct TSussCurveKernel<ESussCurveType::Quadratic>
+{
+	// Only vectorised for small whole exponents (by far the most common), which we can do with multiplies
+	static constexpr int MaxVectorExponent = 8;
+	VectorRegister4Float M, B, C;
+	int Exponent;
+	explicit TSussCurveKernel(const FVector4f& Params)
+		: M(VectorSetFloat1(PARAM_M)), B(VectorSetFloat1(PARAM_B)), C(VectorSetFloat1(PARAM_C)), Exponent(FMath::RoundToInt(PARAM_K)) {}
+
+	static bool CanVectorise(const FVector4f& Params)
+	{
+		return PARAM_K >= 0 && PARAM_K <= MaxVectorExponent && FMath::IsNearlyEqual(PARAM_K, FMath::RoundToFloat(PARAM_K));
+	}
+	static float EvalScalar(float Input, const FVector4f& Params) { return USussUtility::EvalQuadraticCurve(Input, Params); }
+	FORCEINLINE VectorRegister4Float Eval(const VectorRegister4Float& X) const
+	{
+		// m * (x - c)^k + b
+		const VectorRegister4Float D = VectorSubtract(X, C);
+		VectorRegister4Float P = GlobalVectorConstants::FloatOne;
+		for (int i = 0; i < Exponent; ++i)
+		{
+			P = VectorMultiply(P, D);
+		}
+		return VectorMultiplyAdd(M, P, B);
+	}
+};
+
+template<> struct TSussCurveKernel<ESussCurveType::Exponential>
+{
+	VectorRegister4Float K, B, C, Log2M;
+	explicit TSussCurveKernel(const FVector4f& Params)
+		: K(VectorSetFloat1(PARAM_K)), B(VectorSetFloat1(PARAM_B)), C(VectorSetFloat1(PARAM_C)), Log2M(VectorSetFloat1(FMath::Log2(PARAM_M))) {}
+
+	// m^y == 2^(y * log2(m)), only valid for positive m
+	static bool CanVectorise(const FVector4f& Params) { return PARAM_M > 0; }
+	static float EvalScalar(float Input, const FVector4f& Params) { return USussUtility::EvalExponentialCurve(Input, Params); }
+	FORCEINLINE VectorRegister4Float Eval(const VectorRegister4Float& X) const
+	{
+		// m^(kx - c) + b
+		const VectorRegister4Float Exp = VectorSubtract(VectorMultiply(K, X), C);
+		return VectorAdd(VectorExp2(VectorMultiply(Exp, Log2M)), B);
+	}
+};
+
+template<> struct TSussCurveKernel<ESussCurveType::Logistic>
+{
+	VectorRegister4Float K, B, C, Log2Base;
+	explicit TSussCurveKernel(const FVector4f& Params)
+		: K(VectorSetFloat1(PARAM_K)), B(VectorSetFloat1(PARAM_B)), C(VectorSetFloat1(PARAM_C)),
+		  Log2Base(VectorSetFloat1(FMath::Log2(1000.0f*UE_EULERS_NUMBER*PARAM_M))) {}
+
+	// Same as exponential, base must be positive
+	static bool CanVectorise(const FVector4f& Params) { return PARAM_M > 0; }
+	static float EvalScalar(float Input, const FVector4f& Params) { return USussUtility::EvalLogisticCurve(Input, Params); }
+	FORCEINLINE VectorRegister4Float Eval(const VectorRegister4Float& X) const
+	{
+		// k * (1/(1+( (1000*e*m)^(-1 * x + c))) + b
+		const VectorRegister4Float Pow = VectorExp2(VectorMultiply(VectorSubtract(C, X), Log2Base));
+		const VectorRegister4Float One = GlobalVectorConstants::FloatOne;
+		return VectorMultiplyAdd(K, VectorDivide(One, VectorAdd(One, Pow)), B);
+	}
+};
+
+template<ESussCurveType Type>
+static void EvalCurveBatchImpl(const float* RESTRICT Inputs, float* RESTRICT OutScores, int Num, const FVector4f& Params)
+{
+	using FKernel = TSussCurveKernel<Type>;
+
+	int i = 0;
+	if (FKernel::CanVectorise(Params))
+	{
+		const FKernel Kernel(Params);
+		for (; i + 4 <= Num; i += 4)
+		{
+			VectorStore(Kernel.Eval(VectorLoad(Inputs + i)), OutScores + i);
+		}
+	}
+	// Remainder, or everything if we can't vectorise
+	for (; i < Num; ++i)
+	{
+		OutScores[i] = FKernel::EvalScalar(Inputs[i], Params);
+	}
+}
+
+void USussUtility::EvalCurveBatch(ESussCurveType CurveType,
+                                  TConstArrayView<float> Inputs,
+                                  TArrayView<float> OutScores,
+                                  const FVector4f& Params)
+{
+	check(Inputs.Num() == OutScores.Num());
+
+	switch(CurveType)
+	{
+	case ESussCurveType::Step:
+		EvalCurveBatchImpl<ESussCurveType::Step>(Inputs.GetData(), OutScores.GetData(), Inputs.Num(), Params);
+		break;
+	case ESussCurveType::Linear:
+		EvalCurveBatchImpl<ESussCurveType::Linear>(Inputs.GetData(), OutScores.GetData(), Inputs.Num(), Params);
+		break;
+	case ESussCurveType::Exponential:
+		EvalCurveBatchImpl<ESussCurveType::Exponential>(Inputs.GetData(), OutScores.GetData(), Inputs.Num(), Params);
+		break;
+	case ESussCurveType::Quadratic:
+		EvalCurveBatchImpl<ESussCurveType::Quadratic>(Inputs.GetData(), OutScores.GetData(), Inputs.Num(), Params);
+		break;
+	case ESussCurveType::Logistic:
+		EvalCurveBatchImpl<ESussCurveType::Logistic>(Inputs.GetData(), OutScores.GetData(), Inputs.Num(), Params);
+		break;
+	case ESussCurveType::Custom:
+		checkf(false, TEXT("USussUtility::EvalCurveBatch is not valid for custom curves"));
+		break;
+	}
+}
+
 float USussUtility::GetPathDistanceTo(AAIController* Agent, const FVector& Location, bool bAllowPartialPaths)
 {
 	if (Agent && Agent->GetPawn())
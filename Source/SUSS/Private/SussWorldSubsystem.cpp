@@ -11,11 +11,15 @@ USussWorldSubsystem::USussWorldSubsystem()
 	if (const auto Settings = GetDefault<USussSettings>())
 	{
 		CachedFrameTimeBudgetMs = Settings->BrainUpdateFrameTimeBudgetMilliseconds;
+		bCachedPrefetchQueries = Settings->PrefetchQueriesInSpareFrameTime;
+		CachedPrefetchLookaheadSeconds = Settings->QueryPrefetchLookaheadSeconds;
 	}
 	else
 	{
 		UE_LOG(LogSuss, Error, TEXT("Unable to load USussSettings, using hardcoded defaults"))
 		CachedFrameTimeBudgetMs = 0.5f;
+		bCachedPrefetchQueries = true;
+		CachedPrefetchLookaheadSeconds = 0.1f;
 	}
 }
 
@@ -44,8 +48,19 @@ void USussWorldSubsystem::QueueBrainUpdate(USussBrainComponent* Brain)
 	BrainsToUpdate.Enqueue(Brain);
 }
 
+void USussWorldSubsystem::RegisterBrain(USussBrainComponent* Brain)
+{
+	RegisteredBrains.AddUnique(Brain);
+}
+
+void USussWorldSubsystem::UnregisterBrain(USussBrainComponent* Brain)
+{
+	RegisteredBrains.RemoveSingleSwap(Brain);
+}
+
 
 DECLARE_CYCLE_STAT(TEXT("SUSS Brain Update"), STAT_SUSS_BrainUpdate, STATGROUP_SUSS);
+DECLARE_CYCLE_STAT(TEXT("SUSS Query Prefetch"), STAT_SUSS_QueryPrefetch, STATGROUP_SUSS);
 
 void USussWorldSubsystem::UpdateBrains()
 {
@@ -64,7 +79,45 @@ void USussWorldSubsystem::UpdateBrains()
 		}
 		
 		// Time limit
+		if (Timer.Milliseconds() >= CachedFrameTimeBudgetMs)
+			return;
+	}
+
+	// All updates done within budget, use the rest to warm query caches for upcoming updates
+	if (bCachedPrefetchQueries)
+	{
+		PrefetchQueries(Timer);
+	}
+}
+
+void USussWorldSubsystem::PrefetchQueries(FSussScopedPerfTimer& Timer)
+{
+	SCOPE_CYCLE_COUNTER(STAT_SUSS_QueryPrefetch);
+
+	RegisteredBrains.RemoveAllSwap([](const TWeakObjectPtr<USussBrainComponent>& Brain)
+	{
+		return !Brain.IsValid();
+	});
+
+	const int NumBrains = RegisteredBrains.Num();
+	for (int Checked = 0; Checked < NumBrains; ++Checked)
+	{
 		if (Timer.Milliseconds() >= CachedFrameTimeBudgetMs)
 			break;
+
+		NextPrefetchBrainIndex = NextPrefetchBrainIndex % NumBrains;
+		USussBrainComponent* Brain = RegisteredBrains[NextPrefetchBrainIndex++].Get();
+
+		// Only brains whose timer is about to fire; ones already queued will update next frame anyway
+		if (Brain->NeedsUpdate() ||
+			Brain->HasPrefetchedQueries() ||
+			Brain->GetDistanceCategory() == ESussDistanceCategory::OutOfRange)
+			continue;
+
+		const float TimeUntilUpdate = Brain->GetTimeUntilNextUpdateRequest();
+		if (TimeUntilUpdate >= 0 && TimeUntilUpdate <= CachedPrefetchLookaheadSeconds)
+		{
+			Brain->PrefetchQueries(CachedPrefetchLookaheadSeconds);
+		}
 	}
 }
\ No newline at end of file
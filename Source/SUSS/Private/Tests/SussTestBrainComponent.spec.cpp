@@ -1,7 +1,10 @@
 ﻿#include "SussBrainComponent.h"
+#include "SussBrainStateStore.h"
 #include "SussGameSubsystem.h"
 #include "SussTestQueryProviders.h"
 #include "SussTestWorldFixture.h"
+#include "SussUtility.h"
+#include "Inputs/SussExpressionInputProvider.h"
 #if WITH_AUTOMATION_TESTS
 
 UE_DISABLE_OPTIMIZATION
@@ -605,6 +608,317 @@ void FSussBrainTestContextsSpec::Define()
 			
 		});
 
+		It("Query result versions only change when results change", [this]()
+		{
+			AActor* Self = WorldFixture->GetWorld()->SpawnActor<AActor>();
+			auto Brain = Cast<USussBrainComponent>(Self->AddComponentByClass(USussBrainComponent::StaticClass(), false, FTransform::Identity, false));
+			USussTestSingleLocationQueryProvider* Q = USussTestSingleLocationQueryProvider::StaticClass()->GetDefaultObject<USussTestSingleLocationQueryProvider>();
+
+			// reset this manually, query objects are reused
+			Q->NumTimesRun = 0;
+
+			FSussActionDef Action;
+			Action.Queries.Add(FSussQuery {FGameplayTag::RequestGameplayTag(USussTestSingleLocationQueryProvider::TagName) });
+			TArray<TSussQueryResultVersion> Versions1, Versions2;
+			TestTrue("Query should be versioned", Brain->GetQueryResultVersions(Self, Action, Versions1));
+			TestEqual("Query run count", Q->NumTimesRun, 1);
+
+			// Let the cached results expire so the query runs again, returning the same results
+			GetSUSS(WorldFixture->GetWorld())->Tick(1);
+			Brain->GetQueryResultVersions(Self, Action, Versions2);
+			TestEqual("Query should have run again because of time", Q->NumTimesRun, 2);
+			TestTrue("Version should not change when results are the same", Versions1 == Versions2);
+
+			// Different params give different results, & a different version
+			Action.Queries[0].Params.Add("OverrideX", FSussParameter(30.0f));
+			Brain->GetQueryResultVersions(Self, Action, Versions2);
+			TestEqual("Query should have run again because of parameters", Q->NumTimesRun, 3);
+			TestFalse("Version should change when results are different", Versions1 == Versions2);
+		});
+	});
+
+	Describe("Curves", [this]()
+	{
+		It("Batch curve evaluation matches single evaluation", [this]()
+		{
+			// Odd number of inputs to exercise the non-vector remainder
+			TArray<float> Inputs;
+			for (int i = 0; i <= 10; ++i)
+			{
+				Inputs.Add(i * 0.1f);
+			}
+			TArray<float> Outputs;
+			Outputs.SetNumZeroed(Inputs.Num());
+
+			const TArray<TPair<ESussCurveType, FVector4f>> Curves = {
+				{ ESussCurveType::Step, FVector4f(0.5f, 1, 0, 0.2f) },
+				{ ESussCurveType::Linear, FVector4f(-1, 1, 1, 0) },
+				{ ESussCurveType::Quadratic, FVector4f(1, 2, 0, 0.5f) },
+				{ ESussCurveType::Quadratic, FVector4f(1, 0.5f, 0, 0) },
+				{ ESussCurveType::Exponential, FVector4f(2, 3, 0, 1) },
+				{ ESussCurveType::Logistic, FVector4f(1, 1, 0, 0.5f) },
+			};
+			for (const auto& Curve : Curves)
+			{
+				USussUtility::EvalCurveBatch(Curve.Key, Inputs, Outputs, Curve.Value);
+				for (int i = 0; i < Inputs.Num(); ++i)
+				{
+					TestEqual(FString::Printf(TEXT("Curve %d input %4.2f"), (int)Curve.Key, Inputs[i]),
+						Outputs[i], USussUtility::EvalCurve(Curve.Key, Inputs[i], Curve.Value), 0.001f);
+				}
+			}
+		});
+	});
+
+	Describe("Expressions", [this]()
+	{
+		It("Expressions compile and evaluate across contexts", [this]()
+		{
+			FSussExpression Expr;
+			FString Error;
+			TestTrue("Should compile", Expr.Compile(TEXT("Param.Scale * (1 - Location.X / 100) + max(-2, abs(-0.5)) + Location.X / 0"), Error));
+			TestFalse("Unknown function should not compile", FSussExpression().Compile(TEXT("foo(1)"), Error));
+			TestFalse("Unbalanced brackets should not compile", FSussExpression().Compile(TEXT("(1 + 2"), Error));
+			TestFalse("Unknown value should not compile", FSussExpression().Compile(TEXT("Foo.Bar * 2"), Error));
+			TestFalse("Number with two points should not compile", FSussExpression().Compile(TEXT("1.2.3 + 1"), Error));
+			TestFalse("Lone point should not compile", FSussExpression().Compile(TEXT("2 * ."), Error));
+			TestTrue("Number starting with a point should compile", FSussExpression().Compile(TEXT(".5 * 2"), Error));
+
+			TArray<FSussContext> Contexts;
+			Contexts.Add(FSussContext { nullptr, nullptr, FVector(0, 0, 0) });
+			Contexts.Add(FSussContext { nullptr, nullptr, FVector(50, 0, 0) });
+			Contexts.Add(FSussContext { nullptr, nullptr, FVector(100, 0, 0) });
+			TArray<const FSussContext*> ContextPtrs = { &Contexts[0], &Contexts[1], &Contexts[2] };
+			TMap<FName, FSussParameter> Params;
+			Params.Add("Scale", FSussParameter(2.0f));
+
+			TArray<float> Values, Scratch;
+			Values.SetNumZeroed(Contexts.Num());
+			Expr.EvaluateBatch(nullptr, ContextPtrs, Params, Values, Scratch);
+			TestEqual("Context 0", Values[0], 2.5f);
+			TestEqual("Context 1", Values[1], 1.5f);
+			TestEqual("Context 2", Values[2], 0.5f);
+		});
+	});
+
+	Describe("Brain state store", [this]()
+	{
+		It("Stale handles stay invalid when a brain index is re-used", [this]()
+		{
+			FSussBrainStateStore Store;
+			TestFalse("Default handle should be invalid", Store.IsValid(FSussBrainHandle()));
+
+			FSussBrainHandle Handle = Store.AllocateBrain();
+			const FSussBrainHandle Copy = Handle;
+			TestTrue("New handle should be valid", Store.IsValid(Handle));
+			Store.SetNumActions(Handle, 3);
+
+			Store.FreeBrain(Handle);
+			TestFalse("Freed handle should be reset", Handle.IsValid());
+			TestFalse("Copies of a freed handle should be invalid", Store.IsValid(Copy));
+
+			const FSussBrainHandle Reused = Store.AllocateBrain();
+			TestEqual("Brain index should be re-used", Reused.Index, Copy.Index);
+			TestNotEqual("Re-used index should have a new generation", Reused.Generation, Copy.Generation);
+			TestFalse("Stale copy should still be invalid", Store.IsValid(Copy));
+			TestEqual("Number of brains", Store.GetNumBrains(), 1);
+
+			Store.SetNumActions(Reused, 2);
+			TestEqual("Stale copy should see no actions", Store.GetNumActions(Copy), 0);
+			TestEqual("Stale copy should see empty per-action state", Store.GetLastRunScores(Copy).Num(), 0);
+			Store.StartCurrentAction(Copy, 0, 1, 0, 0);
+			TestEqual("Stale copy should not change the new brain's state", Store.GetCurrentActionIndex(Reused), (int32)INDEX_NONE);
+		});
+
+		It("Action ranges are re-used, and the last range is given back", [this]()
+		{
+			FSussBrainStateStore Store;
+			FSussBrainHandle First = Store.AllocateBrain();
+			FSussBrainHandle Second = Store.AllocateBrain();
+			FSussBrainHandle Third = Store.AllocateBrain();
+			Store.SetNumActions(First, 2);
+			Store.SetNumActions(Second, 3);
+			Store.SetNumActions(Third, 3);
+
+			// The first brain's range stays at the start of the per-action arrays
+			auto RangeStart = [&Store, &First](const FSussBrainHandle& Handle)
+			{
+				return static_cast<int32>(Store.GetLastRunScores(Handle).GetData() - Store.GetLastRunScores(First).GetData());
+			};
+			TestEqual("Second range start", RangeStart(Second), 2);
+			TestEqual("Third range start", RangeStart(Third), 5);
+
+			// Freeing the last range shrinks the arrays, so the next new range starts in the same place
+			Store.FreeBrain(Third);
+			FSussBrainHandle Fourth = Store.AllocateBrain();
+			Store.SetNumActions(Fourth, 4);
+			TestEqual("Last range should have been given back", RangeStart(Fourth), 5);
+
+			// Freeing a range in the middle keeps it for the next brain with the same number of actions
+			Store.GetLastRunScores(Second)[1] = 5;
+			Store.SetTempScoreAdjust(Second, 1, 2, 1, 0);
+			Store.FreeBrain(Second);
+			FSussBrainHandle Fifth = Store.AllocateBrain();
+			Store.SetNumActions(Fifth, 3);
+			TestEqual("Freed range should be re-used", RangeStart(Fifth), 2);
+			TestEqual("Re-used run score should be reset", Store.GetLastRunScores(Fifth)[1], 0.0f);
+			TestEqual("Re-used temp adjust should be reset", Store.GetTempScoreAdjust(Fifth, 1, 0), 0.0f);
+			TestEqual("Re-used start time should be reset", Store.GetLastStartTimes(Fifth)[1], -UE_DOUBLE_BIG_NUMBER);
+
+			// Growing moves to a new range, keeping existing entries & defaulting new ones
+			Store.GetLastRunScores(Fourth)[3] = 7;
+			Store.SetNumActions(Fourth, 5);
+			TestEqual("Grown range should be appended", RangeStart(Fourth), 9);
+			TestEqual("Existing entry should be kept", Store.GetLastRunScores(Fourth)[3], 7.0f);
+			TestEqual("New entry should be reset", Store.GetLastRunScores(Fourth)[4], 0.0f);
+
+			// The range it left is free for another brain of that size
+			FSussBrainHandle Sixth = Store.AllocateBrain();
+			Store.SetNumActions(Sixth, 4);
+			TestEqual("Range left by growing should be re-used", RangeStart(Sixth), 5);
+		});
+
+		It("Temporary adjustments move towards 0 from either side", [this]()
+		{
+			FSussBrainStateStore Store;
+			FSussBrainHandle Handle = Store.AllocateBrain();
+			Store.SetNumActions(Handle, 3);
+			Store.SetDecayActive(Handle, true, 0);
+
+			// Brains pass Value / CooldownTime as the rate, so negative adjustments have a negative rate
+			Store.SetTempScoreAdjust(Handle, 0, 1, 0.5f, 0);
+			Store.SetTempScoreAdjust(Handle, 1, -1, -0.5f, 0);
+			Store.SetTempScoreAdjust(Handle, 2, -1, 0.5f, 0);
+			TestEqual("Positive adjust part way", Store.GetTempScoreAdjust(Handle, 0, 1), 0.5f, 0.001f);
+			TestEqual("Negative adjust, negative rate part way", Store.GetTempScoreAdjust(Handle, 1, 1), -0.5f, 0.001f);
+			TestEqual("Negative adjust, positive rate part way", Store.GetTempScoreAdjust(Handle, 2, 1), -0.5f, 0.001f);
+
+			// Stops at 0 rather than overshooting
+			TestEqual("Positive adjust finished", Store.GetTempScoreAdjust(Handle, 0, 5), 0.0f);
+			TestEqual("Negative adjust, negative rate finished", Store.GetTempScoreAdjust(Handle, 1, 5), 0.0f);
+			TestEqual("Negative adjust, positive rate finished", Store.GetTempScoreAdjust(Handle, 2, 5), 0.0f);
+		});
+
+		It("Closed-form cooldowns match the per-update cooldowns they replaced", [this]()
+		{
+			constexpr float ScoreCooldownTime = 4;
+			constexpr float RepetitionPenalty = 1;
+			constexpr float RepetitionPenaltyCooldown = 2;
+			constexpr float TempAdjustCooldownRate = 0.25f;
+
+			// Brain updates with varying intervals; inactive steps are the brain being paused or stopped
+			struct FStep
+			{
+				float Interval;
+				bool bActive;
+			};
+			const TArray<FStep> Steps = {
+				{ 0.5f, true }, { 0.5f, true }, { 0.25f, true }, { 0.25f, true }, { 1, false },
+				{ 3, false }, { 0.1f, true }, { 0.5f, true }, { 1, true }, { 2, true },
+			};
+
+			FSussBrainStateStore Store;
+			FSussBrainHandle Handle = Store.AllocateBrain();
+			Store.SetNumActions(Handle, 2);
+			for (float& Rate : Store.GetRepetitionPenaltyDecayRates(Handle))
+			{
+				Rate = RepetitionPenalty / RepetitionPenaltyCooldown;
+			}
+
+			double Time = 0;
+			bool bActive = true;
+			Store.SetDecayActive(Handle, bActive, Time);
+			Store.StartCurrentAction(Handle, 0, 2, 2 / ScoreCooldownTime, Time);
+			Store.SetTempScoreAdjust(Handle, 1, 1, TempAdjustCooldownRate, Time);
+
+			// What the brain used to calculate, reducing values by the interval on each update
+			int32 RefCurrentAction = 0;
+			float RefScore = 2;
+			float RefScoreCooldownRate = 2 / ScoreCooldownTime;
+			float RefPenalty = 0;
+			float RefTempAdjust = 1;
+
+			for (int s = 0; s < Steps.Num(); ++s)
+			{
+				const FStep& Step = Steps[s];
+				if (Step.bActive != bActive)
+				{
+					bActive = Step.bActive;
+					Store.SetDecayActive(Handle, bActive, Time);
+				}
+				Time += Step.Interval;
+
+				// Paused or stopped brains didn't update, so nothing cooled down
+				if (Step.bActive)
+				{
+					RefScore = FMath::Max(RefScore - RefScoreCooldownRate * Step.Interval, 0.0f);
+					if (RefCurrentAction != 0)
+					{
+						RefPenalty = FMath::Max(RefPenalty - RepetitionPenalty * (Step.Interval / RepetitionPenaltyCooldown), 0.0f);
+					}
+					RefTempAdjust = FMath::Max(RefTempAdjust - TempAdjustCooldownRate * Step.Interval, 0.0f);
+				}
+
+				TestEqual(FString::Printf(TEXT("Current score after step %d"), s), Store.GetCurrentScore(Handle, Time), RefScore, 0.001f);
+				TestEqual(FString::Printf(TEXT("Repetition penalty after step %d"), s), Store.GetRepetitionPenalty(Handle, 0, Time), RefPenalty, 0.001f);
+				TestEqual(FString::Printf(TEXT("Temp adjust after step %d"), s), Store.GetTempScoreAdjust(Handle, 1, Time), RefTempAdjust, 0.001f);
+
+				if (s == 2)
+				{
+					// Switch to the other action, the first one's penalty starts bleeding away
+					Store.EndCurrentAction(Handle, RepetitionPenalty, Time);
+					Store.StartCurrentAction(Handle, 1, 1, 1 / ScoreCooldownTime, Time);
+					RefPenalty += RepetitionPenalty;
+					RefCurrentAction = 1;
+					RefScore = 1;
+					RefScoreCooldownRate = 1 / ScoreCooldownTime;
+				}
+				else if (s == 7)
+				{
+					// Back to the first action, which freezes what's left of its penalty until it ends
+					Store.EndCurrentAction(Handle, 0, Time);
+					Store.StartCurrentAction(Handle, 0, 2, 2 / ScoreCooldownTime, Time);
+					RefCurrentAction = 0;
+					RefScore = 2;
+					RefScoreCooldownRate = 2 / ScoreCooldownTime;
+				}
+			}
+
+			// Sanity check the script covered what it should have
+			TestTrue("Penalty should have been frozen part way", RefPenalty > 0 && RefPenalty < RepetitionPenalty);
+			TestEqual("Temp adjust should have finished", RefTempAdjust, 0.0f);
+		});
+
+		It("Decay clock stops while paused or stopped", [this]()
+		{
+			FSussBrainStateStore Store;
+			FSussBrainHandle Handle = Store.AllocateBrain();
+			Store.SetNumActions(Handle, 1);
+			Store.GetRepetitionPenaltyDecayRates(Handle)[0] = 1;
+
+			// New brains don't cool down until their logic starts
+			Store.StartCurrentAction(Handle, 0, 4, 1, 0);
+			TestEqual("Not started", Store.GetCurrentScore(Handle, 10), 4.0f, 0.001f);
+
+			Store.SetDecayActive(Handle, true, 10);
+			TestEqual("Started", Store.GetCurrentScore(Handle, 11), 3.0f, 0.001f);
+
+			// Paused
+			Store.SetDecayActive(Handle, false, 11);
+			TestEqual("Paused", Store.GetCurrentScore(Handle, 20), 3.0f, 0.001f);
+			// Pausing again mustn't move the point the clock stopped
+			Store.SetDecayActive(Handle, false, 15);
+			Store.SetDecayActive(Handle, true, 20);
+			TestEqual("Resumed", Store.GetCurrentScore(Handle, 21), 2.0f, 0.001f);
+
+			// Ending the action while running, then stopping, holds the penalty where it got to
+			Store.EndCurrentAction(Handle, 2, 21);
+			TestEqual("Penalty cooling down", Store.GetRepetitionPenalty(Handle, 0, 22), 1.0f, 0.001f);
+			Store.SetDecayActive(Handle, false, 22);
+			TestEqual("Stopped", Store.GetRepetitionPenalty(Handle, 0, 100), 1.0f, 0.001f);
+			Store.SetDecayActive(Handle, true, 100);
+			TestEqual("Restarted", Store.GetRepetitionPenalty(Handle, 0, 100.5), 0.5f, 0.001f);
+		});
 	});
 }
 
@@ -40,6 +40,7 @@ class SUSS_API USussGameplayAttributeSelfInputProvider : public USussGameplayAtt
 {
 	GENERATED_BODY()
 public:
+	USussGameplayAttributeSelfInputProvider();
 	virtual float Evaluate_Implementation(const class USussBrainComponent* Brain, const FSussContext& Context,
 		const TMap<FName, FSussParameter>& Parameters) const override;
 };
@@ -51,6 +52,7 @@ class SUSS_API USussGameplayAttributeTargetInputProvider : public USussGameplayA
 {
 	GENERATED_BODY()
 public:
+	USussGameplayAttributeTargetInputProvider();
 	virtual float Evaluate_Implementation(const class USussBrainComponent* Brain, const FSussContext& Context,
 		const TMap<FName, FSussParameter>& Parameters) const override;
 };
\ No newline at end of file
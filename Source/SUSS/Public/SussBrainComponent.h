@@ -3,6 +3,7 @@
 
 #include "CoreMinimal.h"
 #include "SussActionSetAsset.h"
+#include "SussBrainStateStore.h"
 #include "SussContext.h"
 #include "SussGameSubsystem.h"
 #include "SussPoolSubsystem.h"
@@ -11,6 +12,7 @@
 #include "SussBrainComponent.generated.h"
 
 class UCharacterMovementComponent;
+class USussWorldSubsystem;
 
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnSussBrainUpdate, class USussBrainComponent*, Brain);
 /// How to choose the action to run
@@ -103,28 +105,162 @@ public:
 	float Score = 0;
 };
 
+/// An action & context which scored > 0 during an update. The context is not copied, it's an index into the contexts
+/// generated for the action during that update (or INDEX_NONE for the context of the current action).
+struct FSussActionCandidate
+{
+	int ActionDefIndex;
+	int ContextIndex;
+	float Score;
+};
 
-/// History of actions that were previously run
-USTRUCT()
-struct FSussActionHistory
+
+/// Query compiled from an action definition, with its provider resolved & validated
+struct FSussCompiledQuery
 {
-	GENERATED_BODY()
-public:
-	/// The time at which this action was last started
-	double LastStartTime = -UE_DOUBLE_BIG_NUMBER;
-	/// The time at which this action was last completed or interrupted
-	double LastEndTime = -UE_DOUBLE_BIG_NUMBER;
-	/// The context which was last used to run this action
-	FSussContext LastContext;
-	/// The score this action received the last time it was run
-	float LastRunScore = 0;
-	/// Negative scoring bias value which discourages running this action again after it completes (bleeds away over time)
-	float RepetitionPenalty = 0;
-	/// Positive or negative bias applied manually for a temporary period
-	float TempScoreAdjust = 0;
-	/// The speed that TempManualAdjust returns to 0
-	float TempScoreAdjustCooldownRate = 0;
-	
+	const FSussQuery* Query = nullptr;
+	USussQueryProvider* Provider = nullptr;
+	/// If false, all params are literal and can be passed through without resolving
+	bool bHasAutoParameters = false;
+};
+
+/// Consideration compiled from an action definition, with its input provider resolved & literal values pre-baked
+struct FSussCompiledConsideration
+{
+	const FSussConsideration* Consideration = nullptr;
+	USussInputProvider* InputProvider = nullptr;
+	/// If false, all params are literal and can be passed through without resolving
+	bool bHasAutoParameters = false;
+	/// If true, both bookends are literal and BookendMin/Max are pre-resolved
+	bool bLiteralBookends = false;
+	float BookendMin = 0;
+	float BookendMax = 1;
+	/// Baked lookup table if this is a custom curve with a resolution, otherwise null
+	TSharedPtr<const FSussCurveLUT> CurveLUT;
+};
+
+/// A set of gameplay tags as bits, each bit being the index of a tag in some known list
+struct FSussTagBits
+{
+	TArray<uint64, TInlineAllocator<1>> Words;
+
+	void Init(int32 NumBits) { Words.Init(0, FMath::DivideAndRoundUp(NumBits, 64)); }
+	void Set(int32 Bit, bool bValue = true)
+	{
+		const uint64 Mask = uint64(1) << (Bit & 63);
+		Words[Bit >> 6] = bValue ? (Words[Bit >> 6] | Mask) : (Words[Bit >> 6] & ~Mask);
+	}
+	/// Whether every bit set here is also set in Other. Other must be at least as big
+	bool IsSubsetOf(const FSussTagBits& Other) const
+	{
+		for (int32 i = 0; i < Words.Num(); ++i)
+		{
+			if ((Words[i] & ~Other.Words[i]) != 0)
+				return false;
+		}
+		return true;
+	}
+	/// Whether any bit set here is also set in Other. Other must be at least as big
+	bool Intersects(const FSussTagBits& Other) const
+	{
+		for (int32 i = 0; i < Words.Num(); ++i)
+		{
+			if ((Words[i] & Other.Words[i]) != 0)
+				return true;
+		}
+		return false;
+	}
+};
+
+/// Execution plan for an action in an FSussActionTable, compiled once so Update only has to evaluate
+struct FSussCompiledAction
+{
+	/// Valid queries only; queries with no provider, or which duplicate a context element, are removed
+	TArray<FSussCompiledQuery> Queries;
+	TArray<FSussCompiledConsideration> Considerations;
+	/// RequiredTags / BlockingTags as bits over the table's GatingTags
+	FSussTagBits RequiredTagBits;
+	FSussTagBits BlockingTagBits;
+	bool bHasRequiredTags = false;
+	bool bHasBlockingTags = false;
+};
+
+/**
+ * The actions from a brain config (action sets + action defs) combined, sorted by priority and compiled.
+ * Immutable once built, and shared between all brains with the same actions; see USussGameSubsystem::GetActionTable.
+ * Providers are resolved when this is built, so providers registered later are only picked up by new tables.
+ */
+struct FSussActionTable
+{
+	/// Combination of ActionSets and ActionDefs, sorted by ascending priority
+	TArray<FSussActionDef> ActionsByPriority;
+	/// Execution plan for each action in ActionsByPriority order; points into ActionsByPriority
+	TArray<FSussCompiledAction> CompiledActions;
+
+	/// Dense index of each distinct action tag
+	TMap<FGameplayTag, int32> ActionTagIndices;
+	/// Indexes of actions in ActionsByPriority using each tag, by tag index. Can be more than one if the same action
+	/// is used with different params
+	TArray<TArray<int32>> ActionIndicesByTag;
+	/// Tag index of each action in ActionsByPriority order
+	TArray<int32> ActionTagIndexPerAction;
+
+	/// Every tag any action requires or is blocked by, the bit indexes of FSussCompiledAction tag bits
+	TArray<FGameplayTag> GatingTags;
+
+	/// Whether each action in ActionsByPriority order has a valid tag which isn't globally disabled. The only part that
+	/// isn't immutable, USussGameSubsystem updates this when disabled actions change
+	mutable TArray<bool> ActionEnabled;
+
+	int32 FindActionTagIndex(const FGameplayTag& Tag) const
+	{
+		const int32* pIndex = ActionTagIndices.Find(Tag);
+		return pIndex ? *pIndex : INDEX_NONE;
+	}
+	/// Indexes of all actions with a given tag, empty if none
+	TConstArrayView<int32> FindActionIndices(const FGameplayTag& Tag) const
+	{
+		const int32 TagIndex = FindActionTagIndex(Tag);
+		return TagIndex != INDEX_NONE ? TConstArrayView<int32>(ActionIndicesByTag[TagIndex]) : TConstArrayView<int32>();
+	}
+
+	/// The config this was built from, to match other brains with the same actions
+	TArray<TWeakObjectPtr<USussActionSetAsset>> SourceActionSets;
+	TArray<FSussActionDef> SourceActionDefs;
+
+	bool IsBuiltFrom(const FSussBrainConfig& Config) const;
+	static uint32 HashConfigActions(const FSussBrainConfig& Config);
+};
+
+/// Version of the results of one query; the provider is only used for identity, never dereferenced
+typedef TPair<const USussQueryProvider*, uint32> TSussQueryResultVersion;
+
+/// Value of an input cached across updates, for input providers which declare a time to live / invalidation
+struct FSussCachedInputValue
+{
+	float Value = 0;
+	double ExpiryTime = 0;
+	/// Provider cache generation when this value was calculated, stale if the provider has been invalidated since
+	uint32 Generation = 0;
+};
+
+/// Input values cached by a brain for one provider & set of parameters
+struct FSussCachedInputValues
+{
+	const USussInputProvider* Provider = nullptr;
+	uint32 ParamsHash = 0;
+	TMap<FName, FSussParameter> Parameters;
+	TMap<FSussInputContextKey, FSussCachedInputValue> Values;
+};
+
+/// Contexts generated for an action on a previous update, along with the query result versions they came from
+struct FSussCachedActionContexts
+{
+	TWeakObjectPtr<AActor> Self;
+	TArray<TSussQueryResultVersion> QueryVersions;
+	TArray<FSussContext> Contexts;
+	/// False if these contexts can't be re-used, e.g. because they came from correlated or uncached queries
+	bool bValid = false;
 };
 
 UCLASS(ClassGroup=(Custom), meta=(BlueprintSpawnableComponent))
@@ -162,25 +298,83 @@ protected:
 	/// The timer that handles the update requests (and also checks distance).
 	/// This runs at a variable rate depending on distance to players.
 	FTimerHandle UpdateRequestTimer;
-	float CurrentUpdateInterval;
+	/// Whether queries have already been prefetched ahead of the next update
+	bool bQueriesPrefetched = false;
 
 	mutable TWeakObjectPtr<AAIController> AiController;
 
-	/// Combination of ActionSets and ActionDefs, sorted by descending priority group
-	TArray<FSussActionDef> CombinedActionsByPriority;
+	/// Combined & compiled actions, shared with other brains using the same actions. Per-brain state for each action
+	/// (history, cached contexts) is in arrays in the same order as the actions in this table.
+	TSharedPtr<const FSussActionTable> ActionTable;
 
-	/// The scoring result of the current action definition being executed, if any
+	/// The scoring result of the current action definition being executed, if any. Score is as chosen, the current
+	/// (cooling down) score is in the state store, see GetCurrentActionScore()
 	FSussActionScoringResult CurrentActionResult;
 	/// The instance of the action being executed
-	TSussReservedActionPtr CurrentActionInstance;
-
-	TArray<FSussActionScoringResult> CandidateActions;
-	/// Record of when each action in CombinedActionsByPriority order has been run & details 
-	TArray<FSussActionHistory> ActionHistory;
+	FSussReservedActionHandle CurrentActionInstance;
+	/// The native action being executed, if the current action is native. Lives in NativeActionStorage
+	FSussNativeAction* CurrentNativeAction = nullptr;
+	/// Native actions are constructed in here; may hold a finished action until the next tick or native action
+	TAlignedBytes<SussNativeActionMaxSize, 16> NativeActionStorage;
+	bool bNativeActionStorageInUse = false;
+
+	TArray<FSussActionCandidate> CandidateActions;
+	/// Temp storage for indexes of candidates being chosen between
+	TArray<int> CandidateChoiceScratch;
+	/// Handle to this brain's decision state (current score, history of each action in GetActionDefs() order), which
+	/// lives in the world subsystem alongside all other brains' so it can be processed in bulk
+	FSussBrainHandle StateHandle;
+	TWeakObjectPtr<USussWorldSubsystem> StateSubsystem;
+	/// Only used if there's no world subsystem to hold our state, e.g. non-game worlds
+	TUniquePtr<FSussBrainStateStore> LocalBrainStates;
+	/// Latest end time of any action with each tag, by FSussActionTable tag index
+	TArray<double> LastEndTimeByTag;
+
+	/// Contexts generated for each action in GetActionDefs() order, re-used while query results are unchanged
+	TArray<FSussCachedActionContexts> CachedActionContexts;
+	/// Temp storage for query result versions during update
+	TArray<TSussQueryResultVersion> QueryVersionsScratch;
+	/// Temp storage for the results of each uncorrelated query of an action while generating contexts
+	TArray<TSussResultsArray> QueryResultsScratch;
+	/// Temp storage for scoring all contexts of an action one consideration at a time during update
+	TArray<float> ContextScoresScratch;
+	TArray<int> LiveContextsScratch;
+	TArray<const FSussContext*> LiveContextPtrsScratch;
+	TArray<float> InputValuesScratch;
+	TArray<float> NormalisedInputsScratch;
+	TArray<float> CurveScoresScratch;
+	TMap<FName, FSussParameter> ResolvedParamsScratch;
+
+	/// Input values cached across updates, by provider & parameters. Few enough to search linearly, then each keyed
+	/// by the provider's cache key
+	TArray<FSussCachedInputValues> CachedInputValues;
+	double NextInputCachePruneTime = 0;
+
+	/// Auto parameters already resolved against Self alone during this update, by provider tag. Within an update the
+	/// result for a tag is then always the same; resolutions against a full context are never memoised.
+	mutable TMap<FGameplayTag, FSussParameter> ResolvedAutoParamsMemo;
+	mutable TWeakObjectPtr<AActor> ResolvedAutoParamsMemoSelf;
+	mutable uint64 ResolvedAutoParamsMemoFrame = 0;
+	/// Temp storage for evaluating input cache misses in one batch
+	TArray<const FSussContext*> InputCacheMissContexts;
+	TArray<int> InputCacheMissIndices;
+	TArray<FSussInputContextKey> InputCacheMissKeys;
+	TArray<float> InputCacheMissValues;
 
 	UPROPERTY(Transient)
 	UAIPerceptionComponent* PerceptionComp;
 	TMap<FGameplayTag, FDelegateHandle> TagDelegates;
+	/// Ability system which TagDelegates are registered with & prevent tags were snapshotted from
+	TWeakObjectPtr<class UAbilitySystemComponent> PreventUpdateTagsASC;
+	/// Whether tag events for prevent tags should be registered, i.e. logic has been started on the server
+	bool bListenForPreventUpdateTags = false;
+
+	/// Which gating tags self owns. The first bits are the action table's GatingTags, snapshotted at the start of each
+	/// update; after those are PreventBrainUpdateIfAnyTags, kept up to date from tag events
+	FSussTagBits OwnedGatingTags;
+	/// Bits in OwnedGatingTags which prevent updating
+	FSussTagBits PreventUpdateTagBits;
+	int32 NumActionGatingTags = 0;
 
 	bool bIsLogicStopped = false;
 	FString LogicStoppedReason;
@@ -217,6 +411,14 @@ public:
 	/// Update function which triggers an evaluation & action decision
 	void Update();
 
+	/// Get the time in seconds until this brain next requests an update, or a negative value if none is scheduled
+	float GetTimeUntilNextUpdateRequest() const;
+	/// Whether queries for the next update have already been prefetched
+	bool HasPrefetchedQueries() const { return bQueriesPrefetched; }
+	/// Run the uncorrelated queries the next update is going to need, if their cached results are missing or will
+	/// have expired within LookaheadSeconds. Used to warm caches with spare frame time.
+	void PrefetchQueries(float LookaheadSeconds);
+
 	/// Get the AI controller associated with the actor that owns this brain
 	UFUNCTION(BlueprintCallable)
 	AAIController* GetAIController() const;
@@ -345,23 +547,69 @@ public:
 	void AddTemporaryActionScoreAdjustment(int ActionIndex, float Value, float CooldownTime);
 	void ResetTemporaryActionScoreAdjustment(int ActionIndex);
 
+	/// Called by native actions from ActionCompleted
+	void OnNativeActionCompleted(FSussNativeAction* NativeAction);
+
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+	virtual void BeginDestroy() override;
+
 protected:
 	// Called when the game starts
 	virtual void BeginPlay() override;
 	void BrainConfigChanged();
 	void InitActions();
+	/// All actions, sorted by ascending priority
+	const TArray<FSussActionDef>& GetActionDefs() const
+	{
+		static const TArray<FSussActionDef> Empty;
+		return ActionTable.IsValid() ? ActionTable->ActionsByPriority : Empty;
+	}
+	/// Execution plan for each action in GetActionDefs() order
+	const TArray<FSussCompiledAction>& GetCompiledActions() const
+	{
+		static const TArray<FSussCompiledAction> Empty;
+		return ActionTable.IsValid() ? ActionTable->CompiledActions : Empty;
+	}
+	/// Indexes into GetActionDefs() of all actions with a given tag
+	TConstArrayView<int32> FindActionIndices(const FGameplayTag& Tag) const
+	{
+		return ActionTable.IsValid() ? ActionTable->FindActionIndices(Tag) : TConstArrayView<int32>();
+	}
 	ESussActionChoiceMethod GetActionChoiceMethod(int Priority, int& OutTopN) const;
 	void QueueForUpdate();
 	void TimerCallback();
 	float GetDistanceToAnyPlayer() const;
-	void UpdateActionScoreAdjustments(float DeltaTime);
+	FSussBrainStateStore& GetBrainStates() const;
+	/// Allocate our decision state if not already
+	void EnsureBrainState();
+	void FreeBrainState();
+	/// The score of the current action, which cools down over time
+	float GetCurrentActionScore() const;
+	float GetCurrentUpdateInterval() const;
 	void UpdateDistanceCategory();
 	bool IsUpdatePrevented() const;
+	/// Lay out OwnedGatingTags for the current action table & config
+	void InitGatingTags();
+	/// Snapshot which of the action table's gating tags self owns
+	void UpdateOwnedActionGatingTags();
+	/// Snapshot which prevent tags the pawn owns, and register tag events to keep that up to date if listening
+	void RefreshPreventUpdateTags();
+	void UnregisterPreventUpdateTagEvents();
+	/// Re-register prevent tag events if the pawn or its ability system has changed since they were registered
+	void RefreshPreventUpdateTagsIfPawnChanged();
 
 	UFUNCTION()
 	void OnActionCompleted(USussAction* SussAction);
+	bool CanCurrentActionBeInterrupted() const;
+	bool CurrentActionAllowsInterruptionsFromHigherPriorityGroupsOnly() const;
+	/// Run the destructor of any native action in NativeActionStorage
+	void DestroyNativeActionStorage();
+	/// Destroy a finished native action next tick, when it's no longer on the stack, if it hasn't been replaced
+	void DeferDestroyNativeActionStorage();
 	void ChooseActionFromCandidates();
 	void ChooseAction(const FSussActionScoringResult& ActionResult);
+	void ChooseAction(const FSussActionCandidate& Candidate);
+	const FSussContext& GetCandidateContext(const FSussActionCandidate& Candidate) const;
 	void RecordAndResetCurrentAction();
 	void CancelCurrentAction(TSubclassOf<USussAction> Interrupter);
 	UFUNCTION()
@@ -459,16 +707,54 @@ protected:
 		AppendCorrelatedContexts<T>(Self, *ReservedArray.Get<T>(), SourceContext, OutContexts, ValueSetter);
 	}
 
+	void CompileAction(const FSussActionDef& Action, FSussCompiledAction& OutCompiled) const;
+	void CompileQueries(const FSussActionDef& Action, TArray<FSussCompiledQuery>& OutQueries) const;
+	static bool HasAutoParameters(const TMap<FName, FSussParameter>& Params);
+
 	void GenerateContexts(AActor* Self, const FSussActionDef& Action, TArray<FSussContext>& OutContexts);
+	void GenerateContexts(AActor* Self, const FSussActionDef& Action, const TArray<FSussCompiledQuery>& Queries, TArray<FSussContext>& OutContexts);
+	/// Generate contexts; if bResultsFetched, the results of every (uncorrelated) query are already in QueryResultsScratch
+	void GenerateContexts(AActor* Self, const FSussActionDef& Action, const TArray<FSussCompiledQuery>& Queries, bool bResultsFetched, TArray<FSussContext>& OutContexts);
+	/// Fetch the results of all queries for an action into QueryResultsScratch, with the version of each. Fetches
+	/// nothing & returns false if any of the queries are not versioned
+	bool FetchVersionedQueryResults(AActor* Self, const TArray<FSussCompiledQuery>& Queries, TArray<TSussQueryResultVersion>& OutVersions);
+	/// Get the contexts for an action, re-using those generated on a previous update if no query results have changed
+	const TArray<FSussContext>& GetOrGenerateContexts(AActor* Self, int ActionIndex);
+	/// Get the result versions of all queries for an action, returns false if any of the queries are not versioned
+	bool GetQueryResultVersions(AActor* Self, const FSussActionDef& Action, TArray<TSussQueryResultVersion>& OutVersions);
+	bool GetQueryResultVersions(AActor* Self, const TArray<FSussCompiledQuery>& Queries, TArray<TSussQueryResultVersion>& OutVersions);
+	void InvalidatePerceptionQueries();
+	/// Evaluate an input for a batch of contexts, re-using values cached on previous updates where the provider allows
+	void EvaluateInputs(const USussInputProvider* InputProvider,
+		TConstArrayView<const FSussContext*> Contexts,
+		const TMap<FName, FSussParameter>& Params,
+		TArrayView<float> OutValues);
+	void PruneCachedInputValues();
+	FSussCachedInputValues& FindOrAddCachedInputValues(const USussInputProvider* InputProvider, const TMap<FName, FSussParameter>& Params);
 	void IntersectCorrelatedContexts(AActor* Self, const FSussQuery& Query, USussQueryProvider* QueryProvider, const TMap<FName, FSussParameter>& Params, TArray<FSussContext>& InOutContexts);
+	/// Get the results of an uncorrelated query for Self, filtered for this requester if needed, and their version
+	template<typename T>
+	void GetRequesterResults(AActor* Self,
+	                         const FSussQuery& Query,
+	                         USussQueryProvider* QueryProvider,
+	                         const TMap<FName, FSussParameter>& Params,
+	                         TArray<T>& OutResults,
+	                         uint32& OutVersion);
+	/// Replace OutResults with the results of an uncorrelated query for Self, returning their version
+	uint32 FetchUncorrelatedResults(AActor* Self,
+	                                const FSussCompiledQuery& Compiled,
+	                                const TMap<FName, FSussParameter>& Params,
+	                                TSussResultsArray& OutResults);
 	bool AppendUncorrelatedContexts(AActor* Self,
-	                                const FSussQuery& Query,
 	                                USussQueryProvider* QueryProvider,
-	                                const TMap<FName, FSussParameter>& Params,
+	                                const TSussResultsArray& Results,
 	                                TArray<FSussContext>& OutContexts);
 	bool IsActionSameAsCurrent(int NewActionIndex, const FSussContext& NewContext);
 	bool ShouldSubtractRepetitionPenaltyToProposedAction(int NewActionIndex, const FSussContext& NewContext);
 	
 	FSussParameter ResolveParameter(const FSussContext& SelfContext, const FSussParameter& Value) const;
+	FSussParameter ResolveAutoParameter(const FSussContext& SelfContext, const FSussParameter& Value) const;
+	/// Discard auto parameters resolved so far, so they're re-evaluated
+	void ResetResolvedAutoParams() const;
 	void ResolveParameters(AActor* Self, const TMap<FName, FSussParameter>& InParams, TMap<FName, FSussParameter>& OutParams);
 };
@@ -0,0 +1,148 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+
+/// Compact reference to a brain's state in an FSussBrainStateStore. Generation-checked, so a stale handle from a
+/// brain which has since been freed is simply invalid rather than pointing at another brain's state.
+struct FSussBrainHandle
+{
+	int32 Index = INDEX_NONE;
+	uint32 Generation = 0;
+
+	bool IsValid() const { return Index != INDEX_NONE; }
+	void Reset() { Index = INDEX_NONE; Generation = 0; }
+};
+
+/**
+ * The decision state of brains which is touched on every update, held as structure-of-arrays so that whole-world
+ * passes run over contiguous memory rather than chasing each brain component's separate allocations.
+ *
+ * Per-brain values are indexed by FSussBrainHandle::Index. Per-action values for each brain are a contiguous range
+ * within the per-action arrays, in the same order as that brain's actions.
+ *
+ * Values which cool down over time (current score, repetition penalties, temporary adjustments) are stored as the
+ * value at a start time plus a rate, and evaluated when read, so nothing needs updating every tick. Times passed in
+ * are world time in seconds; cooling down is suspended while a brain's decay is inactive (logic paused / stopped).
+ */
+class SUSS_API FSussBrainStateStore
+{
+public:
+	FSussBrainHandle AllocateBrain();
+	void FreeBrain(FSussBrainHandle& Handle);
+	bool IsValid(const FSussBrainHandle& Handle) const
+	{
+		return Generations.IsValidIndex(Handle.Index) && Generations[Handle.Index] == Handle.Generation;
+	}
+
+	/// Resize the per-action state for a brain, keeping existing entries & defaulting new ones
+	void SetNumActions(const FSussBrainHandle& Handle, int32 NumActions);
+	int32 GetNumActions(const FSussBrainHandle& Handle) const
+	{
+		return IsValid(Handle) ? ActionRangeNums[Handle.Index] : 0;
+	}
+
+	/// Values only cool down while decay is active, i.e. a brain's logic is running & not paused
+	void SetDecayActive(const FSussBrainHandle& Handle, bool bActive, double Time);
+
+	/// Make an action current with a score which cools down at ScoreDecayRate per second. Its repetition penalty
+	/// stops cooling down until it ends
+	void StartCurrentAction(const FSussBrainHandle& Handle, int32 ActionIndex, float Score, float ScoreDecayRate, double Time);
+	/// Change the score of the current action, which cools down at the same rate as before
+	void SetCurrentScore(const FSussBrainHandle& Handle, float Score, double Time);
+	/// Record the end of the current action, adding RepetitionPenalty to its (cumulative) penalty
+	void EndCurrentAction(const FSussBrainHandle& Handle, float RepetitionPenalty, double Time);
+	int32 GetCurrentActionIndex(const FSussBrainHandle& Handle) const { return IsValid(Handle) ? CurrentActionIndices[Handle.Index] : INDEX_NONE; }
+	float GetCurrentScore(const FSussBrainHandle& Handle, double Time) const;
+
+	float GetRepetitionPenalty(const FSussBrainHandle& Handle, int32 ActionIndex, double Time) const;
+	float GetTempScoreAdjust(const FSussBrainHandle& Handle, int32 ActionIndex, double Time) const;
+	float GetTempScoreAdjustCooldownRate(const FSussBrainHandle& Handle, int32 ActionIndex) const;
+	/// Set a temporary adjustment from now, which returns to 0 at CooldownRate per second
+	void SetTempScoreAdjust(const FSussBrainHandle& Handle, int32 ActionIndex, float Value, float CooldownRate, double Time);
+	void ResetAllTempScoreAdjusts(const FSussBrainHandle& Handle);
+
+	// Per-action views for one brain, empty if the handle is invalid
+	TArrayView<double> GetLastStartTimes(const FSussBrainHandle& Handle) { return Slice(LastStartTimes, Handle); }
+	TArrayView<double> GetLastEndTimes(const FSussBrainHandle& Handle) { return Slice(LastEndTimes, Handle); }
+	TArrayView<float> GetLastRunScores(const FSussBrainHandle& Handle) { return Slice(LastRunScores, Handle); }
+	TArrayView<float> GetRepetitionPenaltyDecayRates(const FSussBrainHandle& Handle) { return Slice(RepetitionPenaltyDecayRates, Handle); }
+	TConstArrayView<double> GetLastEndTimes(const FSussBrainHandle& Handle) const { return Slice(LastEndTimes, Handle); }
+	TConstArrayView<float> GetLastRunScores(const FSussBrainHandle& Handle) const { return Slice(LastRunScores, Handle); }
+
+	// Per-brain values; handle must be valid
+	float& UpdateInterval(const FSussBrainHandle& Handle) { check(IsValid(Handle)); return UpdateIntervals[Handle.Index]; }
+	float GetUpdateInterval(const FSussBrainHandle& Handle) const { return IsValid(Handle) ? UpdateIntervals[Handle.Index] : 0; }
+
+	int32 GetNumBrains() const { return Generations.Num() - FreeBrainIndices.Num(); }
+
+protected:
+	// Per brain
+	TArray<uint32> Generations;
+	TArray<int32> ActionRangeStarts;
+	TArray<int32> ActionRangeNums;
+	TArray<int32> CurrentActionIndices;
+	/// Score of the current action at CurrentScoreStartTimes
+	TArray<float> CurrentScores;
+	TArray<double> CurrentScoreStartTimes;
+	/// Score per second the current action's score cools down at
+	TArray<float> CurrentScoreDecayRates;
+	TArray<float> UpdateIntervals;
+	/// Start times are on each brain's decay clock, which is world time minus the time decay has been inactive
+	TArray<double> DecayClockOffsets;
+	/// World time that decay was made inactive, or < 0 if active
+	TArray<double> DecayInactiveSince;
+	TArray<int32> FreeBrainIndices;
+
+	// Per action, in ranges per brain
+	/// The time at which each action was last started
+	TArray<double> LastStartTimes;
+	/// The time at which each action was last completed or interrupted
+	TArray<double> LastEndTimes;
+	/// The score each action received the last time it was run
+	TArray<float> LastRunScores;
+	/// Negative scoring bias value which discourages running an action again after it completes, as at
+	/// RepetitionPenaltyStartTimes (bleeds away over time)
+	TArray<float> RepetitionPenalties;
+	TArray<double> RepetitionPenaltyStartTimes;
+	/// Penalty per second that RepetitionPenalties bleed away at
+	TArray<float> RepetitionPenaltyDecayRates;
+	/// Positive or negative bias applied manually for a temporary period, as at TempScoreAdjustStartTimes
+	TArray<float> TempScoreAdjusts;
+	TArray<double> TempScoreAdjustStartTimes;
+	/// The speed that TempScoreAdjusts return to 0
+	TArray<float> TempScoreAdjustCooldownRates;
+	/// Ranges no longer used by any brain, by size. Brains sharing a config need the same size so these get re-used
+	TMap<int32, TArray<int32>> FreeActionRanges;
+
+	template<typename T>
+	TArrayView<T> Slice(TArray<T>& Arr, const FSussBrainHandle& Handle)
+	{
+		return IsValid(Handle) ? TArrayView<T>(Arr.GetData() + ActionRangeStarts[Handle.Index], ActionRangeNums[Handle.Index]) : TArrayView<T>();
+	}
+	template<typename T>
+	TConstArrayView<T> Slice(const TArray<T>& Arr, const FSussBrainHandle& Handle) const
+	{
+		return IsValid(Handle) ? TConstArrayView<T>(Arr.GetData() + ActionRangeStarts[Handle.Index], ActionRangeNums[Handle.Index]) : TConstArrayView<T>();
+	}
+	/// Index into the per-action arrays, or INDEX_NONE if the handle or action index is invalid
+	int32 GetActionStateIndex(const FSussBrainHandle& Handle, int32 ActionIndex) const
+	{
+		return IsValid(Handle) && ActionIndex >= 0 && ActionIndex < ActionRangeNums[Handle.Index] ?
+			ActionRangeStarts[Handle.Index] + ActionIndex : INDEX_NONE;
+	}
+	/// Time on a brain's decay clock
+	double GetDecayClock(int32 BrainIndex, double Time) const
+	{
+		return (DecayInactiveSince[BrainIndex] >= 0 ? DecayInactiveSince[BrainIndex] : Time) - DecayClockOffsets[BrainIndex];
+	}
+	/// A value which was Value at StartTime, moved towards 0 at Rate per second
+	static float Decay(float Value, float Rate, double StartTime, double Now)
+	{
+		const double Amount = FMath::Abs(Rate) * FMath::Max(Now - StartTime, 0.0);
+		return Value > 0 ? static_cast<float>(FMath::Max(Value - Amount, 0.0)) : static_cast<float>(FMath::Min(Value + Amount, 0.0));
+	}
+
+	int32 AllocateActionRange(int32 Num);
+	void FreeActionRange(int32 Start, int32 Num);
+	void ResetActionRange(int32 Start, int32 Num);
+};
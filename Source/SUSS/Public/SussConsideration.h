@@ -9,6 +9,30 @@
 #include "UObject/Object.h"
 #include "SussConsideration.generated.h"
 
+/**
+ * A custom curve baked into evenly spaced samples over the normalised input range (0..1), and evaluated with linear
+ * interpolation. This is much cheaper than UCurveFloat::GetFloatValue, which searches the keys on every evaluation.
+ */
+struct SUSS_API FSussCurveLUT
+{
+	TArray<float> Samples;
+	/// Largest absolute difference from the source curve, measured in between samples when baked
+	float MaxError = 0;
+
+	/// Bake samples from a curve; an invalid curve bakes to all zeroes, same as evaluating it directly
+	void Bake(const UCurveFloat* Curve, int Resolution);
+
+	float Evaluate(float Input) const
+	{
+		const float X = FMath::Clamp(Input, 0.f, 1.f) * (Samples.Num() - 1);
+		const int Index = FMath::Min((int)X, Samples.Num() - 2);
+		return FMath::Lerp(Samples[Index], Samples[Index + 1], X - Index);
+	}
+
+	/// Evaluate a batch of inputs, writing to OutScores which must be the same size
+	void EvaluateBatch(TConstArrayView<float> Inputs, TArrayView<float> OutScores) const;
+};
+
 
 /**
  * A consideration is a scoring function which is assigned to an action, returning a normalised utility value (0..1).
@@ -61,5 +85,11 @@ public:
 	UPROPERTY(EditDefaultsOnly, meta=(EditCondition="CurveType==ESussCurveType::Custom", EditConditionHides))
 	UCurveFloat* CustomCurve = nullptr;
 
+	/// If curve is custom, the number of samples it's baked into for faster evaluation. 0 to evaluate the curve directly.
+	UPROPERTY(EditDefaultsOnly, meta=(EditCondition="CurveType==ESussCurveType::Custom", EditConditionHides, ClampMin=0))
+	int CustomCurveResolution = 64;
+
 	float EvaluateCurve(float Input) const;
+	/// Evaluate the curve for a batch of inputs, writing to OutScores which must be the same size
+	void EvaluateCurveBatch(TConstArrayView<float> Inputs, TArrayView<float> OutScores) const;
 };
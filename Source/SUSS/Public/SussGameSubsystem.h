@@ -5,7 +5,9 @@
 #include "CoreMinimal.h"
 #include "GameplayTagContainer.h"
 #include "SussAction.h"
+#include "SussConsideration.h"
 #include "SussInputProvider.h"
+#include "SussNativeAction.h"
 #include "SussQueryProvider.h"
 #include "SussParameterProvider.h"
 #include "Engine/ObjectLibrary.h"
@@ -23,6 +25,8 @@ protected:
 	UPROPERTY()
 	TMap<FGameplayTag, TSubclassOf<USussAction>> ActionClasses;
 
+	TMap<FGameplayTag, FSussNativeActionFactory> NativeActionFactories;
+
 	UPROPERTY()
 	TMap<FGameplayTag, USussInputProvider*> InputProviders;
 
@@ -46,8 +50,29 @@ protected:
 
 	TSet<FName> MissingTagsAlreadyWarnedAbout;
 
+	/// Custom curves baked into lookup tables, shared by all brains using the same curve & resolution
+	TMap<TPair<TObjectKey<UCurveFloat>, int>, TSharedRef<FSussCurveLUT>> CurveLUTs;
+
+	/// Action tables currently in use by brains, by hash of the actions in their config
+	TMultiMap<uint32, TWeakPtr<const struct FSussActionTable>> ActionTables;
+
+	/// DisabledActionTags from settings merged with runtime overrides, plus their parents since that's what matching
+	/// against the container means
+	TSet<FGameplayTag> DisabledActionTagSet;
+	/// Runtime overrides from SetActionEnabled, applied on top of DisabledActionTags from settings. Kept here rather
+	/// than in settings so they only last as long as this game instance
+	FGameplayTagContainer RuntimeDisabledActionTags;
+	FGameplayTagContainer RuntimeEnabledActionTags;
+#if WITH_EDITOR
+	/// Curves which have been edited and need their lookup tables re-baked
+	TSet<TObjectKey<UCurveFloat>> DirtyCurves;
+	/// Settings have been edited and disabled actions need refreshing
+	bool bDisabledActionsDirty = false;
+#endif
+
 public:
 	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
 
 	/// Register an action class
 	UFUNCTION(BlueprintCallable)
@@ -59,6 +84,28 @@ public:
 
 	TSubclassOf<USussAction> GetActionClass(FGameplayTag ActionTag);
 
+	/// Register a native action struct for a tag, see FSussNativeAction. Native actions take precedence over action
+	/// classes registered with the same tag.
+	template<typename T>
+	void RegisterNativeAction(const FGameplayTag& ActionTag)
+	{
+		static_assert(TIsDerivedFrom<T, FSussNativeAction>::Value, "Native actions must derive from FSussNativeAction");
+		static_assert(sizeof(T) <= SussNativeActionMaxSize, "Native action is too large to be stored inline, see SussNativeActionMaxSize");
+		static_assert(alignof(T) <= 16, "Native action alignment must be 16 or less");
+
+		FSussNativeActionFactory Factory;
+		Factory.Construct = [](void* Storage) -> FSussNativeAction* { return new (Storage) T(); };
+		NativeActionFactories.Add(ActionTag, Factory);
+	}
+
+	void UnregisterNativeAction(const FGameplayTag& ActionTag) { NativeActionFactories.Remove(ActionTag); }
+
+	/// Get the factory for a native action, or null if there isn't a native action for this tag
+	const FSussNativeActionFactory* GetNativeActionFactory(const FGameplayTag& ActionTag) const
+	{
+		return NativeActionFactories.Find(ActionTag);
+	}
+
 	/// Register an input provider by class
 	UFUNCTION(BlueprintCallable)
 	void RegisterInputProviderClass(TSubclassOf<USussInputProvider> ProviderClass);
@@ -105,6 +152,27 @@ public:
 	UFUNCTION(BlueprintCallable)
 	USussParameterProvider* GetParameterProvider(const FGameplayTag& Tag);
 
+	/// Get a lookup table for a custom curve baked at a given resolution, baking it if it's not been used before.
+	/// In the editor, the table is updated in place if the curve is edited.
+	TSharedRef<const FSussCurveLUT> GetCurveLUT(UCurveFloat* Curve, int Resolution);
+
+	/// Get the combined & compiled action table for the actions in a brain config, shared with any other brains using the
+	/// same actions. If no brain is currently using these actions, a new table is built using CompileAction.
+	TSharedRef<const struct FSussActionTable> GetActionTable(const struct FSussBrainConfig& Config,
+		TFunctionRef<void(const struct FSussActionDef&, struct FSussCompiledAction&)> CompileAction);
+
+	/// Globally enable or disable an action at runtime, overriding DisabledActionTags in settings for this game instance
+	UFUNCTION(BlueprintCallable)
+	void SetActionEnabled(FGameplayTag ActionTag, bool bEnabled);
+	/// Whether an action is globally enabled, see DisabledActionTags in settings
+	bool IsActionEnabled(const FGameplayTag& ActionTag) const
+	{
+		return ActionTag.IsValid() && !DisabledActionTagSet.Contains(ActionTag);
+	}
+	/// Re-read DisabledActionTags from settings, merge runtime overrides and update every action table; call this if
+	/// you change the settings directly
+	void RefreshDisabledActions();
+
 	virtual TStatId GetStatId() const override;
 	virtual UWorld* GetTickableGameObjectWorld() const override;
 	virtual void Tick(float DeltaTime) override;
@@ -113,6 +181,12 @@ protected:
 	void LoadClassesFromLibrary(const TArray<FDirectoryPath>& Paths, UObjectLibrary* ObjectLibrary, TArray<FSoftObjectPath>& OutSoftPaths);
 	void LoadClassesFromLibrary(const TArray<FString>& Paths, UObjectLibrary* ObjectLibrary, TArray<FSoftObjectPath>& OutSoftPaths);
 	void RegisterNativeProviders();
+	void BakeCurveLUT(UCurveFloat* Curve, int Resolution, FSussCurveLUT& LUT);
+	void UpdateActionsEnabled(const struct FSussActionTable& Table) const;
+#if WITH_EDITOR
+	void OnObjectChanged(UObject* Object);
+	void RebakeDirtyCurves();
+#endif
 
 
 };
@@ -6,10 +6,69 @@
 #include "Engine/DataAsset.h"
 #include "GameplayTagContainer.h"
 #include "SussContext.h"
+#include "SussParameter.h"
 #include "UObject/Object.h"
+#include "UObject/ObjectKey.h"
+#include <atomic>
 #include "SussInputProvider.generated.h"
 
+/// How the results of an input can be shared between all brains within a frame
+UENUM(BlueprintType)
+enum class ESussInputMemoScope : uint8
+{
+	/// Every evaluation is calculated separately
+	None,
+	/// The value only depends on the Target of the context (and parameters), not on Self
+	Target,
+	/// The value only depends on the Location of the context (and parameters), not on Self
+	Location,
+	/// The value only depends on parameters, e.g. a global game state
+	Global
+};
+
+/// Which parts of a context a cached input value depends on. Parameters are always part of the key.
+UENUM(BlueprintType)
+enum class ESussInputCacheKey : uint8
+{
+	/// Only depends on Self, so one value is cached regardless of context
+	Self,
+	Target,
+	Location,
+	TargetAndLocation
+};
 
+/// Which parts of a context a natively implemented input's value depends on, so that a batch only evaluates values
+/// which can differ. Not exposed to Blueprints, since a Blueprint Evaluate override is always called per context.
+enum class ESussInputBatchDependency : uint8
+{
+	/// The value may differ for every context
+	Context,
+	/// Only depends on Self, so is only re-evaluated when the controlled actor changes between contexts
+	Self,
+	/// Doesn't depend on the context at all, so is evaluated once per batch
+	None
+};
+
+/// The parts of a context that a memoised or cached input value depends on. Compared in full, so that values for
+/// different targets / locations can never be confused when their hashes collide.
+struct FSussInputContextKey
+{
+	TObjectKey<AActor> Target;
+	FVector Location = FVector::ZeroVector;
+
+	FSussInputContextKey() {}
+	FSussInputContextKey(const AActor* InTarget, const FVector& InLocation) : Target(InTarget), Location(InLocation) {}
+
+	bool operator==(const FSussInputContextKey& Other) const
+	{
+		return Target == Other.Target && Location == Other.Location;
+	}
+
+	friend uint32 GetTypeHash(const FSussInputContextKey& Key)
+	{
+		return HashCombine(GetTypeHash(Key.Target), GetTypeHash(Key.Location));
+	}
+};
 
 /**
  * An input provider supplies a float input value to a considerations, which is determined at runtime, and identified by an input tag.
@@ -33,6 +92,56 @@ protected:
 	/// The tag which identifies the input which this provider is supplying
 	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(Categories="Suss.Input"))
 	FGameplayTag InputTag;
+
+	/// If the value of this input doesn't depend on Self, it can be calculated once per frame per Target / Location
+	/// (or just once if global) and shared between all brains. Only set this if that's actually true! 
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly)
+	ESussInputMemoScope MemoScope = ESussInputMemoScope::None;
+
+	/// Values memoised this frame for one set of parameters
+	struct FMemoEntry
+	{
+		uint32 ParamsHash = 0;
+		TMap<FName, FSussParameter> Parameters;
+		TMap<FSussInputContextKey, float> Values;
+	};
+	/// Values memoised this frame, by parameters. There are only ever a handful of distinct parameter sets per input.
+	/// Shared by all brains, which may be updating on other threads, so only accessed under MemoGuard
+	mutable TArray<FMemoEntry> MemoEntries;
+	mutable uint64 MemoFrame = 0;
+	mutable FCriticalSection MemoGuard;
+
+	FSussInputContextKey MakeMemoKey(const FSussContext& Context) const;
+	/// Find the memo entry for these parameters, discarding values from previous frames. MemoGuard must be locked
+	FMemoEntry& FindOrAddMemoEntry(const TMap<FName, FSussParameter>& Parameters, uint32 ParamsHash) const;
+
+	/// For inputs which change slowly, the time in seconds for which each brain can re-use a value it calculated
+	/// previously for the same context key & parameters. 0 to always re-evaluate.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(ClampMin=0))
+	float CacheTimeToLive = 0;
+
+	/// If true, brains re-use values they calculated previously until InvalidateCachedValues is called
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly)
+	bool bCacheUntilInvalidated = false;
+
+	/// Which parts of the context a cached value depends on. Named values are never part of the key, so don't cache
+	/// inputs which depend on them.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(EditCondition="CacheTimeToLive>0||bCacheUntilInvalidated"))
+	ESussInputCacheKey CacheKey = ESussInputCacheKey::TargetAndLocation;
+
+	/// Incremented to invalidate all values cached by brains
+	/// Atomic since brains may be updating on other threads; only ever incremented, so relaxed ordering is enough
+	std::atomic<uint32> CacheGeneration { 0 };
+	mutable std::atomic<uint64> CacheHits { 0 };
+	mutable std::atomic<uint64> CacheMisses { 0 };
+
+	/// Which parts of the context the native implementation of Evaluate depends on, see EvaluateBatch
+	ESussInputBatchDependency BatchDependency = ESussInputBatchDependency::Context;
+
+	/// Whether Evaluate is overridden by a Blueprint subclass, in which case native batching must not bypass it.
+	/// Resolved on first use, since it's fixed per class: -1 unknown, 0 no, 1 yes
+	mutable std::atomic<int8> EvaluateInBlueprint { -1 };
+	bool IsEvaluateImplementedInBlueprint() const;
 	
 public:
 
@@ -45,4 +154,47 @@ public:
 	/// Also used to resolve parameters to queries and other inputs, in which case context is solely the Self reference
 	UFUNCTION(BlueprintNativeEvent, BlueprintCallable)	
 	float Evaluate(const class USussBrainComponent* Brain, const FSussContext& Context, const TMap<FName, FSussParameter>& Parameters) const;
+
+	/// Evaluate the input for a batch of contexts, writing to OutValues which must be the same size.
+	/// If a Blueprint subclass overrides Evaluate, it's called for each context. Otherwise Evaluate_Implementation is
+	/// called directly to avoid the overhead of the Blueprint event, only once per value allowed by BatchDependency.
+	virtual void EvaluateBatch(const class USussBrainComponent* Brain,
+		TConstArrayView<const FSussContext*> Contexts,
+		const TMap<FName, FSussParameter>& Parameters,
+		TArrayView<float> OutValues) const;
+
+	/// Evaluate a batch of contexts via EvaluateBatch, but re-using values already calculated this frame (by any
+	/// brain) if this input has a MemoScope. Only contexts which missed the memo are passed to EvaluateBatch. 
+	void EvaluateBatchMemoised(const class USussBrainComponent* Brain,
+		TConstArrayView<const FSussContext*> Contexts,
+		const TMap<FName, FSussParameter>& Parameters,
+		TArrayView<float> OutValues) const;
+
+	/// Discard memoised values before the end of the frame, for providers that know their source has changed
+	UFUNCTION(BlueprintCallable)
+	void InvalidateMemo() const;
+
+	bool IsCachingValues() const { return CacheTimeToLive > 0 || bCacheUntilInvalidated; }
+	float GetCacheTimeToLive() const { return CacheTimeToLive; }
+	uint32 GetCacheGeneration() const { return CacheGeneration.load(std::memory_order_relaxed); }
+	/// The parts of a context which values cached by brains are keyed on, see CacheKey
+	FSussInputContextKey MakeCacheKey(const FSussContext& Context) const;
+	void RecordCacheLookups(int Hits, int Misses) const
+	{
+		CacheHits.fetch_add(Hits, std::memory_order_relaxed);
+		CacheMisses.fetch_add(Misses, std::memory_order_relaxed);
+	}
+
+	/// Discard all values of this input cached by brains, e.g. when the source of a bCacheUntilInvalidated input changes
+	UFUNCTION(BlueprintCallable)
+	void InvalidateCachedValues() { CacheGeneration.fetch_add(1, std::memory_order_relaxed); }
+
+	/// Proportion of lookups of cached values of this input, across all brains, which didn't need to re-evaluate
+	UFUNCTION(BlueprintPure)
+	float GetCacheHitRate() const;
+	uint64 GetCacheHits() const { return CacheHits.load(std::memory_order_relaxed); }
+	uint64 GetCacheMisses() const { return CacheMisses.load(std::memory_order_relaxed); }
+
+	static uint32 HashParameters(const TMap<FName, FSussParameter>& Parameters);
+	static bool ParametersMatch(const TMap<FName, FSussParameter>& Params1, const TMap<FName, FSussParameter>& Params2);
 };
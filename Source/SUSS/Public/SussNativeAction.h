@@ -0,0 +1,80 @@
+﻿// 
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameplayTagContainer.h"
+#include "SussContext.h"
+#include "SussParameter.h"
+#include "Templates/SubclassOf.h"
+
+class USussAction;
+class USussBrainComponent;
+
+/// Max size of a native action struct, since they're stored inline in the brain
+static constexpr int32 SussNativeActionMaxSize = 512;
+
+/**
+ * A lightweight alternative to USussAction for small native behaviours, implemented as a plain C++ struct.
+ * Native actions are constructed directly in storage inside the brain when chosen, so there's no UObject allocation,
+ * pooling or GC cost. They follow the same contract as USussAction: PerformAction when chosen, ContinueAction when
+ * the brain decides to keep going, CancelAction if interrupted, and you MUST call ActionCompleted() at the natural end.
+ *
+ * Register by tag with USussGameSubsystem::RegisterNativeAction<T>(). Because they're not classes, the
+ * PreviousActionClass / InterruptedByActionClass passed to and from native actions is always null.
+ * Since there's no UObject, nothing here is visible to GC; only hold weak references to other objects.
+ */
+struct SUSS_API FSussNativeAction
+{
+protected:
+	USussBrainComponent* Brain = nullptr;
+	FSussContext CurrentContext;
+	int BrainActionIndex = -1;
+	FGameplayTag ActionTag;
+
+public:
+	virtual ~FSussNativeAction() = default;
+
+	void Init(USussBrainComponent* InBrain, const FSussContext& InContext, int ActionIndex, const FGameplayTag& InActionTag)
+	{
+		Brain = InBrain;
+		CurrentContext = InContext;
+		BrainActionIndex = ActionIndex;
+		ActionTag = InActionTag;
+	}
+
+	const FGameplayTag& GetActionTag() const { return ActionTag; }
+	USussBrainComponent* GetBrain() const { return Brain; }
+	const FSussContext& GetCurrentContext() const { return CurrentContext; }
+	UWorld* GetWorld() const;
+
+	virtual bool CanBeInterrupted() const { return true; }
+	virtual bool AllowInterruptionsFromHigherPriorityGroupsOnly() const { return false; }
+
+	/// Called when the action has been decided on, see USussAction::PerformAction
+	virtual void PerformAction(const FSussContext& Context, const TMap<FName, FSussParameter>& Params, TSubclassOf<USussAction> PreviousActionClass) = 0;
+	/// Called when the brain has updated, and the decision is to continue with this action
+	virtual void ContinueAction(const FSussContext& Context, const TMap<FName, FSussParameter>& Params) {}
+	/// Called when the action has been interrupted before completion
+	virtual void CancelAction(TSubclassOf<USussAction> InterruptedByActionClass) {}
+	/// Output a series of locations in the gameplay debugger
+	virtual void DebugLocations(TArray<FVector>& OutLocations, bool bIncludeDetails) const {}
+
+	/// Call this when the action completes normally, but not when cancelled.
+	/// The action is finished with after this; it's destroyed on the next tick, or before the brain's next action is started if that's sooner.
+	void ActionCompleted();
+
+	/// See USussAction::SetTemporaryActionScoreAdjustment
+	void SetTemporaryActionScoreAdjustment(float Value, float CooldownTime);
+	/// See USussAction::AddTemporaryScoreAdjustment
+	void AddTemporaryScoreAdjustment(float Value, float CooldownTime);
+	/// See USussAction::ResetTemporaryScoreAdjustment
+	void ResetTemporaryScoreAdjustment();
+};
+
+/// How to construct a registered native action, see USussGameSubsystem::RegisterNativeAction
+struct FSussNativeActionFactory
+{
+	/// Construct the action in place in Storage, which is SussNativeActionMaxSize bytes aligned to 16
+	FSussNativeAction* (*Construct)(void* Storage) = nullptr;
+};
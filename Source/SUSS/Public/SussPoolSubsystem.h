@@ -6,23 +6,40 @@
 #include "SussContext.h"
 #include "SussParameter.h"
 #include "Subsystems/GameInstanceSubsystem.h"
+#include "Tickable.h"
+
+#include <atomic>
 #include "SussPoolSubsystem.generated.h"
 
 /// Variant typed pointer holder (passed by value)
 struct FSussPooledArrayPtr
 {
 protected:
-	bool bIsBound;
-	/// Internal variant pointer
-	TVariant<
+	typedef TVariant<
 		TArray<TWeakObjectPtr<AActor>>*,
 		TArray<FVector>*,
 		TArray<FRotator>*,
 		TArray<FGameplayTag>*,
 		TArray<FSussContextValue>*,
-		TArray<FSussContext>*> ArrayPointer;
+		TArray<FSussContext>*> FVariantType;
+
+	bool bIsBound;
+	/// Internal variant pointer
+	FVariantType ArrayPointer;
 
 public:
+	/// Number of different array types which can be pooled
+	static constexpr SIZE_T NumTypes = TVariantSize<FVariantType>::Value;
+
+	/// Index of a pooled array type, resolved at compile time
+	template<typename T>
+	static constexpr SIZE_T TypeIndex()
+	{
+		return FVariantType::IndexOfType<TArray<T>*>();
+	}
+
+	SIZE_T GetTypeIndex() const { return ArrayPointer.GetIndex(); }
+
 	FSussPooledArrayPtr() : bIsBound(false) {}
 	FSussPooledArrayPtr(TArray<TWeakObjectPtr<AActor>>* InActors) : bIsBound(true)
 	{
@@ -114,6 +131,21 @@ public:
 		}
 	}
 
+	/// Memory allocated by the pooled array, in bytes
+	SIZE_T GetAllocatedSize() const
+	{
+		return bIsBound ? Visit([](const auto* Array) { return Array->GetAllocatedSize(); }, ArrayPointer) : 0;
+	}
+
+	/// Release the array's allocation, for when it's grown larger than is usually needed
+	void Trim() const
+	{
+		if (bIsBound)
+		{
+			Visit([](auto* Array) { Array->Empty(); }, ArrayPointer);
+		}
+	}
+
 	void Reset() const
 	{
 		if (bIsBound)
@@ -175,13 +207,18 @@ struct FSussScopeReservedArray
 protected:
 	FSussPooledArrayPtr Holder;
 	TWeakObjectPtr<class USussPoolSubsystem> OwningSystem;
+	/// False if default constructed or moved-from, in which case there's nothing to free
+	bool bOwnsHolder = false;
+
+	/// Give the holder back to the owning system, if we still own it
+	void Free();
 public:
 	FSussScopeReservedArray()
 	{
 	}
 
-	FSussScopeReservedArray(const FSussPooledArrayPtr& H, USussPoolSubsystem* System) : Holder(H), OwningSystem(System) {}
-	~FSussScopeReservedArray();
+	FSussScopeReservedArray(const FSussPooledArrayPtr& H, USussPoolSubsystem* System) : Holder(H), OwningSystem(System), bOwnsHolder(true) {}
+	~FSussScopeReservedArray() { Free(); }
 
 	template<typename T>
 	TArray<T>* Get()
@@ -191,16 +228,23 @@ public:
 	
 	FSussScopeReservedArray(FSussScopeReservedArray&& Other) noexcept
 		: Holder(std::move(Other.Holder)),
-		  OwningSystem(std::move(Other.OwningSystem))
+		  OwningSystem(std::move(Other.OwningSystem)),
+		  bOwnsHolder(Other.bOwnsHolder)
 	{
+		// Moved-from must not free the holder as well
+		Other.bOwnsHolder = false;
 	}
 	
 	FSussScopeReservedArray& operator=(FSussScopeReservedArray&& Other) noexcept
 	{
 		if (this == &Other)
 			return *this;
+		// Give back whatever we had before taking over theirs
+		Free();
 		Holder = std::move(Other.Holder);
 		OwningSystem = std::move(Other.OwningSystem);
+		bOwnsHolder = Other.bOwnsHolder;
+		Other.bOwnsHolder = false;
 		return *this;
 	}
 };
@@ -208,13 +252,27 @@ public:
 struct FSussPooledMapPtr
 {
 protected:
-	/// Internal variant pointer
-	TVariant<
+	typedef TVariant<
 		TMap<FName, FSussParameter>*,
 		TMap<FName, FSussContextValue>*,
-		TMap<FName, FSussScopeReservedArray>*> MapPointer;
+		TMap<FName, FSussScopeReservedArray>*> FVariantType;
+
+	/// Internal variant pointer
+	FVariantType MapPointer;
 
 public:
+	/// Number of different map types which can be pooled
+	static constexpr SIZE_T NumTypes = TVariantSize<FVariantType>::Value;
+
+	/// Index of a pooled map type, resolved at compile time
+	template<typename K, typename V>
+	static constexpr SIZE_T TypeIndex()
+	{
+		return FVariantType::IndexOfType<TMap<K,V>*>();
+	}
+
+	SIZE_T GetTypeIndex() const { return MapPointer.GetIndex(); }
+
 	FSussPooledMapPtr(TMap<FName, FSussParameter>* Params)
 	{
 		MapPointer.Set<TMap<FName, FSussParameter>*>(Params);
@@ -246,6 +304,18 @@ public:
 		}
 	}
 
+	/// Memory allocated by the pooled map, in bytes
+	SIZE_T GetAllocatedSize() const
+	{
+		return Visit([](const auto* Map) { return Map->GetAllocatedSize(); }, MapPointer);
+	}
+
+	/// Release the map's allocation, for when it's grown larger than is usually needed
+	void Trim() const
+	{
+		Visit([](auto* Map) { Map->Empty(); }, MapPointer);
+	}
+
 	void Reset() const
 	{
 		// A bit clunky but it's the price we pay for a non-templated holder
@@ -283,9 +353,14 @@ struct FSussScopeReservedMap
 protected:
 	FSussPooledMapPtr Holder;
 	TWeakObjectPtr<class USussPoolSubsystem> OwningSystem;
+	/// False if moved-from, in which case there's nothing to free
+	bool bOwnsHolder = false;
+
+	/// Give the holder back to the owning system, if we still own it
+	void Free();
 public:
-	FSussScopeReservedMap(const FSussPooledMapPtr& H, USussPoolSubsystem* System) : Holder(H), OwningSystem(System) {}
-	~FSussScopeReservedMap();
+	FSussScopeReservedMap(const FSussPooledMapPtr& H, USussPoolSubsystem* System) : Holder(H), OwningSystem(System), bOwnsHolder(true) {}
+	~FSussScopeReservedMap() { Free(); }
 
 	template<typename K, typename V>
 	TMap<K, V>* Get()
@@ -295,16 +370,23 @@ public:
 	
 	FSussScopeReservedMap(FSussScopeReservedMap&& Other) noexcept
 		: Holder(std::move(Other.Holder)),
-		  OwningSystem(std::move(Other.OwningSystem))
+		  OwningSystem(std::move(Other.OwningSystem)),
+		  bOwnsHolder(Other.bOwnsHolder)
 	{
+		// Moved-from must not free the holder as well
+		Other.bOwnsHolder = false;
 	}
 
 	FSussScopeReservedMap& operator=(FSussScopeReservedMap&& Other) noexcept
 	{
 		if (this == &Other)
 			return *this;
+		// Give back whatever we had before taking over theirs
+		Free();
 		Holder = std::move(Other.Holder);
 		OwningSystem = std::move(Other.OwningSystem);
+		bOwnsHolder = Other.bOwnsHolder;
+		Other.bOwnsHolder = false;
 		return *this;
 	}
 };
@@ -319,41 +401,179 @@ public:
 	TArray<class USussAction*> Pool;
 };
 
-// Used to auto-free actions
-typedef TSharedPtr<USussAction, ESPMode::ThreadSafe> TSussReservedActionPtr;
+/// Slot holding a reserved action, so that reserved actions are visible to GC
+USTRUCT()
+struct FSussReservedActionSlot
+{
+	GENERATED_BODY()
+public:
+	/// Null when the slot is free
+	UPROPERTY()
+	USussAction* Action = nullptr;
+	/// Incremented every time the slot is freed, so stale handles are ignored
+	uint32 Generation = 0;
+};
+
+/**
+ * Handle to an action reserved from the pool, which frees it back to the pool when reset or destroyed. Handles can
+ * be moved but not copied, so there's exactly one owner of each reserved action.
+ */
+struct SUSS_API FSussReservedActionHandle
+{
+protected:
+	USussAction* Action = nullptr;
+	TWeakObjectPtr<class USussPoolSubsystem> Pool;
+	int32 SlotIndex = INDEX_NONE;
+	uint32 Generation = 0;
+
+public:
+	FSussReservedActionHandle() {}
+	FSussReservedActionHandle(USussAction* InAction, USussPoolSubsystem* InPool, int32 InSlotIndex, uint32 InGeneration)
+		: Action(InAction), Pool(InPool), SlotIndex(InSlotIndex), Generation(InGeneration) {}
+	~FSussReservedActionHandle() { Reset(); }
+
+	FSussReservedActionHandle(const FSussReservedActionHandle&) = delete;
+	FSussReservedActionHandle& operator=(const FSussReservedActionHandle&) = delete;
+
+	FSussReservedActionHandle(FSussReservedActionHandle&& Other) noexcept
+		: Action(Other.Action), Pool(Other.Pool), SlotIndex(Other.SlotIndex), Generation(Other.Generation)
+	{
+		Other.Action = nullptr;
+		Other.SlotIndex = INDEX_NONE;
+	}
+
+	FSussReservedActionHandle& operator=(FSussReservedActionHandle&& Other) noexcept
+	{
+		if (this != &Other)
+		{
+			Reset();
+			Action = Other.Action;
+			Pool = Other.Pool;
+			SlotIndex = Other.SlotIndex;
+			Generation = Other.Generation;
+			Other.Action = nullptr;
+			Other.SlotIndex = INDEX_NONE;
+		}
+		return *this;
+	}
+
+	/// Free the action back to the pool
+	void Reset();
+
+	bool IsValid() const { return Action != nullptr; }
+	USussAction* Get() const { return Action; }
+	USussAction* operator->() const { check(Action); return Action; }
+};
+
+/// Usage stats for one pooled container type
+struct FSussPoolTypeStats
+{
+	/// Histogram buckets are powers of 2 bytes, starting at 64 bytes; the last bucket includes everything larger
+	static constexpr int NumHistogramBuckets = 16;
+
+	/// Number currently reserved
+	std::atomic<int32> NumOutstanding { 0 };
+	/// Most ever reserved at the same time
+	std::atomic<int32> HighWaterOutstanding { 0 };
+	/// Most reserved at the same time since the pool was last trimmed
+	std::atomic<int32> PeakOutstandingSinceTrim { 0 };
+	/// Largest allocation seen when a container was freed, in bytes
+	std::atomic<int64> HighWaterBytes { 0 };
+	/// Number of frees by allocation size, see NumHistogramBuckets
+	std::atomic<int32> CapacityHistogram[NumHistogramBuckets] = {};
+
+	void RecordReserve();
+	void RecordFree(SIZE_T AllocatedBytes);
+	static int GetHistogramBucket(SIZE_T AllocatedBytes);
+};
+
+/// Free lists owned by one thread, so that most reservations & frees don't need to take a lock
+struct FSussPoolThreadCache
+{
+	/// Max number of free items per type kept by a thread, beyond this they're returned to the shared free lists
+	static constexpr int MaxPerType = 8;
+
+	uint32 PoolId = 0;
+	TArray<FSussPooledArrayPtr> FreeArrays[FSussPooledArrayPtr::NumTypes];
+	TArray<FSussPooledMapPtr> FreeMaps[FSussPooledMapPtr::NumTypes];
+};
 
 
 /**
  * Helper system to provide re-usable pools of eg arrays between brains so they don't have to maintain their own for temp results.
  */
 UCLASS()
-class USussPoolSubsystem : public UGameInstanceSubsystem
+class USussPoolSubsystem : public UGameInstanceSubsystem, public FTickableGameObject
 {
 	GENERATED_BODY()
 protected:
-	mutable FCriticalSection Guard;
+	// Separate locks per pool kind, so that e.g. array reservations during scoring don't contend with action reservations
+	mutable FCriticalSection ArrayGuard;
+	mutable FCriticalSection MapGuard;
+	mutable FCriticalSection ActionGuard;
+
+	/// Shared free lists, one per type. Threads take from here when their own cache is empty
+	TArray<FSussPooledArrayPtr> FreeArrayPools[FSussPooledArrayPtr::NumTypes];
+	TArray<FSussPooledMapPtr> FreeMapPools[FSussPooledMapPtr::NumTypes];
+
+	/// Unique id of this pool, so threads can find their cache for it
+	uint32 PoolId = 0;
+	/// Set on Deinitialize, after which containers are no longer pooled. Read from any thread
+	std::atomic<bool> bDeinitialized { false };
+	FCriticalSection ThreadCacheGuard;
+	TArray<TUniquePtr<FSussPoolThreadCache>> ThreadCaches;
 
-	TArray<FSussPooledArrayPtr> FreeArrayPools;
-	TArray<FSussPooledMapPtr> FreeMapPools;
+	/// Get the calling thread's cache for this pool, creating it if needed
+	FSussPoolThreadCache& GetThreadCache();
+
+	FSussPoolTypeStats ArrayStats[FSussPooledArrayPtr::NumTypes];
+	FSussPoolTypeStats MapStats[FSussPooledMapPtr::NumTypes];
+	float TimeSinceTrim = 0;
+
+	/// Release free containers beyond what's recently been needed, then the largest buffers if over the memory cap
+	void TrimFreeLists();
 
 	UPROPERTY()
 	TMap<UClass*, FSussActionPool> FreeActionClassPools;
-	// For GC purposes
+	/// Action classes waiting to be pre-warmed, and the number of instances wanted
+	UPROPERTY()
+	TMap<UClass*, int> PendingActionPrewarms;
+	FDelegateHandle PostLoadMapHandle;
+
+	void OnPostLoadMap(UWorld* World);
+	/// Create some of the pending pre-warmed action instances, up to the per-frame limit
+	void ProcessActionPrewarms();
+	/// Reserved actions, indexed by handle slot. Also keeps them visible for GC purposes
 	UPROPERTY()
-	TMap<UClass*, FSussActionPool> ReservedActionClassPools;
+	TArray<FSussReservedActionSlot> ReservedActionSlots;
+	TArray<int32> FreeReservedActionSlots;
+	/// Number of actions of each class currently reserved
+	TMap<UClass*, int> NumReservedActionsByClass;
 	
 	template<typename T>
 	FSussScopeReservedArray ReserveArrayImpl()
 	{
-		FScopeLock Lock(&Guard);
+		constexpr SIZE_T TypeIndex = FSussPooledArrayPtr::TypeIndex<T>();
+		ArrayStats[TypeIndex].RecordReserve();
+
+		if (bDeinitialized)
+		{
+			// Free lists & thread caches are gone, just hand out a new one which FreeArray will destroy
+			return FSussScopeReservedArray(FSussPooledArrayPtr(new TArray<T>()), this);
+		}
+
+		auto& ThreadFree = GetThreadCache().FreeArrays[TypeIndex];
+		if (ThreadFree.Num() > 0)
+		{
+			return FSussScopeReservedArray(ThreadFree.Pop(), this);
+		}
 
-		for (int i = 0; i < FreeArrayPools.Num(); ++i)
 		{
-			if (FreeArrayPools[i].ContainsType<T>())
+			FScopeLock Lock(&ArrayGuard);
+			auto& SharedFree = FreeArrayPools[TypeIndex];
+			if (SharedFree.Num() > 0)
 			{
-				FSussPooledArrayPtr H = FreeArrayPools[i];
-				FreeArrayPools.RemoveAt(i);
-				return FSussScopeReservedArray(H, this);
+				return FSussScopeReservedArray(SharedFree.Pop(), this);
 			}
 		}
 
@@ -365,15 +585,27 @@ protected:
 	template<typename K, typename V>
 	FSussScopeReservedMap ReserveMapImpl()
 	{
-		FScopeLock Lock(&Guard);
+		constexpr SIZE_T TypeIndex = FSussPooledMapPtr::TypeIndex<K,V>();
+		MapStats[TypeIndex].RecordReserve();
+
+		if (bDeinitialized)
+		{
+			// Free lists & thread caches are gone, just hand out a new one which FreeMap will destroy
+			return FSussScopeReservedMap(FSussPooledMapPtr(new TMap<K,V>()), this);
+		}
 
-		for (int i = 0; i < FreeMapPools.Num(); ++i)
+		auto& ThreadFree = GetThreadCache().FreeMaps[TypeIndex];
+		if (ThreadFree.Num() > 0)
 		{
-			if (FreeMapPools[i].ContainsType<K,V>())
+			return FSussScopeReservedMap(ThreadFree.Pop(), this);
+		}
+
+		{
+			FScopeLock Lock(&MapGuard);
+			auto& SharedFree = FreeMapPools[TypeIndex];
+			if (SharedFree.Num() > 0)
 			{
-				FSussPooledMapPtr H = FreeMapPools[i];
-				FreeMapPools.RemoveAt(i);
-				return FSussScopeReservedMap(H, this);
+				return FSussScopeReservedMap(SharedFree.Pop(), this);
 			}
 		}
 
@@ -384,39 +616,63 @@ protected:
 
 public:
 
+	/// Reserve an array from the pool. CapacityHint is the number of elements typically needed; since pooled arrays
+	/// keep their allocations, this means typical sizes only need to be allocated once.
 	template<typename T>
-	FSussScopeReservedArray ReserveArray()
+	FSussScopeReservedArray ReserveArray(int32 CapacityHint = 0)
 	{
-		return ReserveArrayImpl<T>();
+		FSussScopeReservedArray Reserved = ReserveArrayImpl<T>();
+		if (CapacityHint > 0)
+		{
+			Reserved.Get<T>()->Reserve(CapacityHint);
+		}
+		return Reserved;
 	}
 	
-	void FreeArray(const FSussPooledArrayPtr& Holder)
-	{
-		FScopeLock Lock(&Guard);
-
-		Holder.Reset();
-		FreeArrayPools.Add(Holder);
-	}
+	void FreeArray(const FSussPooledArrayPtr& Holder);
 
+	/// Reserve a map from the pool. CapacityHint is the number of entries typically needed, see ReserveArray
 	template<typename K, typename V>
-	FSussScopeReservedMap ReserveMap()
+	FSussScopeReservedMap ReserveMap(int32 CapacityHint = 0)
 	{
-		return ReserveMapImpl<K, V>();
+		FSussScopeReservedMap Reserved = ReserveMapImpl<K, V>();
+		if (CapacityHint > 0)
+		{
+			Reserved.Get<K, V>()->Reserve(CapacityHint);
+		}
+		return Reserved;
 	}
 	
-	void FreeMap(const FSussPooledMapPtr& Holder)
-	{
-		FScopeLock Lock(&Guard);
-
-		Holder.Reset();
-		FreeMapPools.Add(Holder);
-	}
+	void FreeMap(const FSussPooledMapPtr& Holder);
 
-	TSussReservedActionPtr ReserveAction(UClass* ActionClass, UObject* TemplateIfCreated);
-
-	// Not neededby clients, just clear your TSussReservedActionPtr
-	void InternalFreeAction(USussAction* Action);
+	template<typename T>
+	const FSussPoolTypeStats& GetArrayStats() const { return ArrayStats[FSussPooledArrayPtr::TypeIndex<T>()]; }
+	template<typename K, typename V>
+	const FSussPoolTypeStats& GetMapStats() const { return MapStats[FSussPooledMapPtr::TypeIndex<K,V>()]; }
+
+	/// Reserve an instance of an action class, which is freed back to the pool when the returned handle is reset
+	FSussReservedActionHandle ReserveAction(UClass* ActionClass, UObject* TemplateIfCreated);
+
+	// Not needed by clients, just reset your FSussReservedActionHandle
+	void InternalFreeAction(int32 SlotIndex, uint32 Generation);
+
+	/// Queue creation of pooled instances of an action class, so that at least Count exist. Instances are created a few
+	/// per frame (see ActionPrewarmMaxPerFrame in settings) so that the cost doesn't all land in one frame
+	void PrewarmAction(UClass* ActionClass, int Count);
+	/// Queue pre-warming of the classes of all these actions, see PrewarmAction
+	void PrewarmActions(const TArray<struct FSussActionDef>& Actions, int CountPerClass);
+	/// Queue pre-warming of the classes of all actions in a brain config, including its action sets
+	void PrewarmActions(const struct FSussBrainConfig& Config, int CountPerClass);
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
 	virtual void Deinitialize() override;
+
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override;
+	virtual ETickableTickType GetTickableTickType() const override
+	{
+		return HasAnyFlags(RF_ClassDefaultObject) ? ETickableTickType::Never : ETickableTickType::Always;
+	}
+	virtual void Tick(float DeltaTime) override;
 };
 
 inline USussPoolSubsystem* GetSussPool(UWorld* WorldContext)
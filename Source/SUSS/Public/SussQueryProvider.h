@@ -7,6 +7,7 @@
 #include "GameplayTagContainer.h"
 #include "SussContext.h"
 #include "UObject/Object.h"
+#include "UObject/ObjectKey.h"
 #include "SussParameter.h"
 #include "SussQueryProvider.generated.h"
 
@@ -33,14 +34,34 @@ typedef TVariant<
 		TArray<FSussContextValue>
 	> TSussResultsArray;
 
-struct FSussCachedQueryResults
+struct FSussCachedQueryResults : public TSharedFromThis<FSussCachedQueryResults, ESPMode::ThreadSafe>
 {
 public:
 	TMap<FName, FSussParameter> Params;
 	TWeakObjectPtr<AActor> ControlledActor;
 	float TimeSinceLastRun = 100000;
 	TSussResultsArray Results;
+	/// Results from the run before last, kept to detect changes (and to re-use the allocation)
+	TSussResultsArray PreviousResults;
+	/// Version of Results, which only changes when the results actually change. Unique across all entries of a provider
+	uint32 Version = 0;
+	/// Whether the query has been executed at least once into this entry
+	bool bHasResults = false;
+	/// If results are shared spatially, the grid cell the querier was in when the query was run
+	FIntVector SpatialCell = FIntVector::ZeroValue;
+	/// Owner / cell this entry is currently listed under in the provider's invalidation index
+	TObjectKey<AActor> IndexedOwner;
+	FIntVector IndexedCell = FIntVector::ZeroValue;
+	bool bIndexed = false;
+
+	/// Held while the query for this entry is being executed ("in flight"). Concurrent requesters for the same key
+	/// block on this and then re-use the fresh results rather than executing the query again.
+	FCriticalSection ExecutionGuard;
 };
+
+typedef TSharedRef<FSussCachedQueryResults, ESPMode::ThreadSafe> TSussCachedQueryResultsRef;
+typedef TSharedPtr<FSussCachedQueryResults, ESPMode::ThreadSafe> TSussCachedQueryResultsPtr;
+
 /**
  * Query providers are responsible for supplying some element of context for action evaluation, e.g. a location, or a target.
  * Action descriptions in a brain list all the queries they need running, and in turn the queries declare which elements
@@ -104,15 +125,58 @@ protected:
 	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly)
 	bool bUseCachedResults = true;
 
+	/// If true, instead of caching results per querying agent, agents standing in the same grid cell share cached
+	/// results (within MaxFrequency). Useful for expensive location queries (EQS grids, cover searches) whose results
+	/// barely change between agents standing close together.
+	/// Only relevant if bSelfIsRelevant is true & results are cached.
+	/// Note: shared results are generated for whichever agent ran the query, so if the query excludes Self from its
+	/// results (as most target queries do), the other agents in the cell will never see that agent as a target. Don't
+	/// share target queries whose results should include nearby agents, e.g. allies.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(EditCondition="bSelfIsRelevant && bUseCachedResults"))
+	bool bShareResultsBySpatialCell = false;
+
+	/// The size of grid cells used to share results between agents when bShareResultsBySpatialCell is true
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(EditCondition="bShareResultsBySpatialCell", ClampMin=1))
+	float SpatialCellSize = 200;
+
+	/// When sharing results by spatial cell, whether to re-filter the shared results for each requesting agent
+	/// (see FilterSharedResults), e.g. so that an agent doesn't receive itself as a target found by its neighbour.
+	/// Re-filtering can only remove results, so it can't restore the agent that ran the query if it excluded itself
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, meta=(EditCondition="bShareResultsBySpatialCell"))
+	bool bRefilterSharedResults = true;
+
+	/// If true, cached results for an agent are invalidated whenever that agent's perception is updated. Set this on
+	/// queries that read perception data, so they can be cached for longer but still respond immediately to changes.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly)
+	bool bInvalidateOnPerceptionUpdate = false;
+
 	/// Set this to true if you're using raw pointers to structs as results (C++ only) and want to keep caching results
 	/// without having warnings all the time. Use with caution! You must be absolutely sure that the structs the cached
 	/// results point to will outlive the cache.
 	bool bDisableRawPointerCacheWarning = false; 
 
 	// Cached results for each params combination
-	TMap<uint32, FSussCachedQueryResults> CachedResultsByParamsHash;
+	// Entries are shared refs so they stay address-stable while other threads add to the map
+	TMap<uint32, TSussCachedQueryResultsRef> CachedResultsByParamsHash;
+
+	/// Protects the structure of CachedResultsByParamsHash only. Lookups take a read lock, adding / removing entries
+	/// takes a write lock. Query execution is guarded per entry, see FSussCachedQueryResults::ExecutionGuard
+	mutable FRWLock CacheLock;
 
-	mutable FCriticalSection Guard;
+	/// Source of result versions; shared by all cache entries so a removed & re-created entry never repeats a version
+	std::atomic<uint32> ResultVersionCounter = 0;
+
+	typedef TArray<TWeakPtr<FSussCachedQueryResults, ESPMode::ThreadSafe>> TSussCachedQueryResultsWeakList;
+	/// Cache entries by the agent whose request last ran them (or by grid cell when sharing results spatially), so
+	/// that invalidating one agent's results only visits the entries it owns. Guarded by EntryIndexGuard
+	TMap<TObjectKey<AActor>, TSussCachedQueryResultsWeakList> EntriesByOwner;
+	TMap<FIntVector, TSussCachedQueryResultsWeakList> EntriesByCell;
+	FCriticalSection EntryIndexGuard;
+
+	/// Move an entry to the right list in the invalidation index after it has been run. Entry's ExecutionGuard must be held
+	void IndexCacheEntry(FSussCachedQueryResults& Entry);
+	/// Drop index entries for cache entries which have been removed
+	void PruneCacheEntryIndex();
 
 	template<typename T>
 	static void InitResults(TSussResultsArray& OutResults)
@@ -156,36 +220,141 @@ public:
 
 	virtual void Tick(float DeltaTime)
 	{
-		FScopeLock Lock(&Guard);
-		
-		TArray<uint32> KeysToRemove;
-		for (auto& Result : CachedResultsByParamsHash)
+		bool bRemovedAny = false;
 		{
-			// If the AI that used to use this has gone stale, remove
-			if (Result.Value.ControlledActor.IsStale() || !Result.Value.ControlledActor.IsValid())
+			// Entries are updated without holding CacheLock, so that waiting on an entry whose query is running
+			// doesn't block every other lookup on this provider (or deadlock a query which makes one)
+			TArray<TPair<uint32, TSussCachedQueryResultsRef>> Entries;
+			{
+				FReadScopeLock Lock(CacheLock);
+				Entries.Reserve(CachedResultsByParamsHash.Num());
+				for (const auto& Result : CachedResultsByParamsHash)
+				{
+					Entries.Emplace(Result.Key, Result.Value);
+				}
+			}
+
+			TArray<TPair<uint32, TSussCachedQueryResultsRef>> EntriesToRemove;
+			for (const auto& Entry : Entries)
 			{
-				KeysToRemove.Add(Result.Key);
+				FScopeLock EntryLock(&Entry.Value->ExecutionGuard);
+				// If the AI that used to use this has gone stale, remove
+				if (Entry.Value->ControlledActor.IsStale() || !Entry.Value->ControlledActor.IsValid())
+				{
+					EntriesToRemove.Add(Entry);
+				}
+				else
+				{
+					Entry.Value->TimeSinceLastRun += DeltaTime;
+				}
 			}
-			else
+
+			if (EntriesToRemove.Num() > 0)
 			{
-				Result.Value.TimeSinceLastRun += DeltaTime;
+				FWriteScopeLock Lock(CacheLock);
+				for (const auto& Entry : EntriesToRemove)
+				{
+					// Only if it hasn't been replaced since we looked
+					const auto pEntry = CachedResultsByParamsHash.Find(Entry.Key);
+					if (pEntry && *pEntry == Entry.Value)
+					{
+						CachedResultsByParamsHash.Remove(Entry.Key);
+						bRemovedAny = true;
+					}
+				}
 			}
 		}
 
-		for (uint32 Key : KeysToRemove)
+		// Once our references to removed entries have gone, so they show up as dead in the index
+		if (bRemovedAny)
 		{
-			CachedResultsByParamsHash.Remove(Key);
+			PruneCacheEntryIndex();
 		}
 	}
 
-	/// Retrieves the query results, using cached values if possible
+	/// Retrieves the query results, using cached values if possible, and appends them to OutResults.
+	/// Safe to call from multiple threads; only one requester executes the query for a given key, others wait & re-use.
+	/// Results are copied while the cache entry is still locked, since another requester may re-run the query after.
 	template<typename T>
-	const TArray<T>& GetResults(USussBrainComponent* Brain, AActor* Self, float MaxFrequency, const TMap<FName, FSussParameter>& Params)
+	void GetResults(USussBrainComponent* Brain, AActor* Self, float MaxFrequency, const TMap<FName, FSussParameter>& Params, TArray<T>& OutResults)
+	{
+		uint32 Version;
+		GetResults<T>(Brain, Self, MaxFrequency, Params, OutResults, Version);
+	}
+
+	/// As GetResults, also returning the version of the results appended (see GetResultsVersion). Both come from the
+	/// same locked access to the cache entry, so the version always describes exactly these results.
+	template<typename T>
+	void GetResults(USussBrainComponent* Brain, AActor* Self, float MaxFrequency, const TMap<FName, FSussParameter>& Params, TArray<T>& OutResults, uint32& OutVersion)
+	{
+		const TSussCachedQueryResultsRef Entry = FindOrAddCacheEntry(HashQueryRequest(Self, Params));
+		FScopeLock EntryLock(&Entry->ExecutionGuard);
+		MaybeExecuteQuery(*Entry, Brain, Self, MaxFrequency, Params);
+		OutResults.Append(GetResultsArray<T>(Entry->Results));
+		OutVersion = Entry->Version;
+	}
+
+	/// Whether results of this query have meaningful versions, see GetResultsVersion
+	bool HasVersionedResults() const { return bUseCachedResults && !bIsCorrelatedWithContext; }
+
+	/**
+	 * Retrieves the version of the results for a request, running the query if needed under the same rules as GetResults.
+	 * The version only changes when the results actually change, so callers can skip re-processing results they
+	 * already have. Only meaningful if HasVersionedResults() is true.
+	 */
+	uint32 GetResultsVersion(USussBrainComponent* Brain, AActor* Self, float MaxFrequency, const TMap<FName, FSussParameter>& Params)
+	{
+		const TSussCachedQueryResultsRef Entry = FindOrAddCacheEntry(HashQueryRequest(Self, Params));
+		FScopeLock EntryLock(&Entry->ExecutionGuard);
+		MaybeExecuteQuery(*Entry, Brain, Self, MaxFrequency, Params);
+		return Entry->Version;
+	}
+
+	/// Mark cached results requested by a given agent as out of date, so that the next request runs the query again.
+	/// Use this when you know the source data of the query has changed, e.g. on perception updates. If results turn
+	/// out to be the same, the results version does not change.
+	/// Only entries owned by the agent are affected: those last run for it, or for its grid cell if sharing results
+	/// spatially. Results shared between all agents (bSelfIsRelevant=false) are only invalidated by the agent whose
+	/// request last ran them, so that every other agent's updates don't defeat the sharing.
+	void InvalidateCachedResults(AActor* Self);
+
+	/// Whether the results of this query should be invalidated every time the perception of the querying agent is updated
+	bool ShouldInvalidateOnPerceptionUpdate() const { return bInvalidateOnPerceptionUpdate; }
+
+	/**
+	 * Run the query ahead of time, if the cached results for this request are missing or will have expired within
+	 * LookaheadSeconds, so that a subsequent GetResults call finds a warm cache.
+	 * @return Whether the query was actually executed. Correlated or non-caching queries are never prefetched.
+	 */
+	bool PrefetchResults(USussBrainComponent* Brain, AActor* Self, float MaxFrequency, float LookaheadSeconds, const TMap<FName, FSussParameter>& Params)
 	{
-		FScopeLock Lock(&Guard);
+		if (bIsCorrelatedWithContext || !bUseCachedResults)
+			return false;
 		
-		auto& Results = MaybeExecuteQuery(Brain, Self, MaxFrequency, Params, CachedResultsByParamsHash);
-		return GetResultsArray<T>(Results.Results);
+		const uint32 ParamsHash = HashQueryRequest(Self, Params);
+		const TSussCachedQueryResultsRef Entry = FindOrAddCacheEntry(ParamsHash);
+
+		FScopeLock EntryLock(&Entry->ExecutionGuard);
+		// Bring the max frequency forward by the lookahead so results about to expire count as stale already
+		if (Entry->bHasResults && ShouldUseCachedResults(*Entry, Brain, Self, MaxFrequency - LookaheadSeconds, Params))
+			return false;
+
+		ExecuteQuery(Brain, Self, Params, *Entry);
+		return true;
+	}
+
+	/// Whether results need to be filtered for each requesting agent, see FilterResultsForRequester
+	bool NeedsRequesterFiltering() const { return IsSharingResultsSpatially() && bRefilterSharedResults; }
+
+	/// If results are shared between nearby agents, filter a copy of those results for the requesting agent.
+	/// Does nothing if this query doesn't share results spatially, or re-filtering is disabled.
+	template<typename T>
+	void FilterResultsForRequester(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, TArray<T>& InOutResults)
+	{
+		if (NeedsRequesterFiltering())
+		{
+			FilterSharedResults(Brain, Self, Params, InOutResults);
+		}
 	}
 
 	/// Run the query, correlated with an existing context generated from another query
@@ -199,8 +368,11 @@ public:
 
 protected:
 
+	bool IsSharingResultsSpatially() const { return bShareResultsBySpatialCell && bSelfIsRelevant && bUseCachedResults; }
+	FIntVector GetSpatialCell(AActor* Self) const;
 	uint32 HashQueryRequest(AActor* Self, const TMap<FName, FSussParameter>& Params);
 	bool ParamsMatch(const TMap<FName, FSussParameter>& Params1, const TMap<FName, FSussParameter>& Params2) const;
+	static bool ResultsMatch(const TSussResultsArray& Results1, const TSussResultsArray& Results2);
 
 	virtual bool ShouldUseCachedResults(const FSussCachedQueryResults& Results, USussBrainComponent* Brain, AActor* Self, float MaxFrequency, const TMap<FName, FSussParameter>& Params) const
 	{
@@ -212,8 +384,16 @@ protected:
 		if (Results.TimeSinceLastRun >= MaxFrequency)
 			return false;
 
-		if (Results.ControlledActor.Get() != Self)
+		if (IsSharingResultsSpatially())
+		{
+			// Any agent in the same cell can re-use
+			if (Results.SpatialCell != GetSpatialCell(Self))
+				return false;
+		}
+		else if (Results.ControlledActor.Get() != Self)
+		{
 			return false;
+		}
 
 		// Otherwise, if we're within the re-use time, the only time we should not re-use is if the value of a relevant
 		// parameter is different. Relevant parameters for queries may be a subset of the total parameter list
@@ -224,6 +404,21 @@ protected:
 	{
 		// Subclass specific
 	}
+	/// Re-filter results generated by another agent in the same spatial cell for this requesting agent
+	/// By default an agent is removed from target results so it never receives itself. The agent which generated the
+	/// results isn't known here, so if it excluded itself it can't be added back (see bShareResultsBySpatialCell)
+	virtual void FilterSharedResults(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, TArray<TWeakObjectPtr<AActor>>& InOutResults)
+	{
+		InOutResults.Remove(Self);
+	}
+	virtual void FilterSharedResults(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, TArray<FVector>& InOutResults)
+	{
+		// Subclass specific
+	}
+	virtual void FilterSharedResults(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, TArray<FSussContextValue>& InOutResults)
+	{
+		// Subclass specific
+	}
 	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, TArray<TWeakObjectPtr<AActor>>& OutResults)
 	{
 		// Subclass specific
@@ -242,30 +437,57 @@ protected:
 		OutResults.Params = Params;
 		OutResults.ControlledActor = Self;
 		OutResults.TimeSinceLastRun = 0;
+		if (IsSharingResultsSpatially())
+		{
+			OutResults.SpatialCell = GetSpatialCell(Self);
+		}
+
+		// Keep the last results to compare against; swapping also keeps both allocations alive for re-use
+		Swap(OutResults.Results, OutResults.PreviousResults);
 		ExecuteQueryInternal(Brain, Self, Params, OutResults.Results);
+
+		if (!OutResults.bHasResults || !ResultsMatch(OutResults.Results, OutResults.PreviousResults))
+		{
+			OutResults.Version = ++ResultVersionCounter;
+		}
+		OutResults.bHasResults = true;
+
+		IndexCacheEntry(OutResults);
 	}
 	
-	const FSussCachedQueryResults& MaybeExecuteQuery(USussBrainComponent* Brain,
-	                                                 AActor* Self,
-	                                                 float MaxFrequency,
-	                                                 const TMap<FName, FSussParameter>& Params,
-	                                                 TMap<uint32, FSussCachedQueryResults>& CachedResults)
+	TSussCachedQueryResultsRef FindOrAddCacheEntry(uint32 ParamsHash)
 	{
-		const uint32 ParamsHash = HashQueryRequest(Self, Params);
-		if (const auto pResultStruct = CachedResults.Find(ParamsHash))
 		{
-			if (!ShouldUseCachedResults(*pResultStruct, Brain, Self, MaxFrequency, Params))
+			// Fast path, entry already exists
+			FReadScopeLock ReadLock(CacheLock);
+			if (const auto pEntry = CachedResultsByParamsHash.Find(ParamsHash))
 			{
-				// Run query again, but re-use cache entry. Reset to keep allocations
-				ExecuteQuery(Brain, Self, Params, *pResultStruct);
+				return *pEntry;
 			}
-			return *pResultStruct;
 		}
 
-		// First run of this query
-		auto& ResultStruct = CachedResults.Emplace(ParamsHash);
-		ExecuteQuery(Brain, Self, Params, ResultStruct);
-		return ResultStruct;
+		// Another thread may have added it between the read & write locks, FindOrAdd covers that
+		FWriteScopeLock WriteLock(CacheLock);
+		if (const auto pEntry = CachedResultsByParamsHash.Find(ParamsHash))
+		{
+			return *pEntry;
+		}
+		return CachedResultsByParamsHash.Emplace(ParamsHash, MakeShared<FSussCachedQueryResults, ESPMode::ThreadSafe>());
+	}
+	
+	/// Runs the query into Entry unless its cached results can be re-used. Caller must hold Entry.ExecutionGuard, so
+	/// that anyone else asking for the same key waits, then finds results they can re-use.
+	void MaybeExecuteQuery(FSussCachedQueryResults& Entry,
+	                       USussBrainComponent* Brain,
+	                       AActor* Self,
+	                       float MaxFrequency,
+	                       const TMap<FName, FSussParameter>& Params)
+	{
+		if (!Entry.bHasResults || !ShouldUseCachedResults(Entry, Brain, Self, MaxFrequency, Params))
+		{
+			// Run query again, but re-use cache entry. Reset to keep allocations
+			ExecuteQuery(Brain, Self, Params, Entry);
+		}
 	}
 	
 };
@@ -409,23 +631,24 @@ protected:
 	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly)
 	ESussContextValueType QueryValueType = ESussContextValueType::Float;
 
-	// We need to hold this to allow BP to fill in
-	TArray<FSussContextValue>* TempOutArray;
+	/// Add a value to the results of the query currently executing on this thread; used by the BP helpers below,
+	/// since the results array itself can't be passed to BP. Only valid inside ExecuteQuery.
+	void AddValue(const FSussContextValue& Value);
 
 	UFUNCTION(BlueprintCallable)
-	void AddValueActor(AActor* Value) { TempOutArray->Add(FSussContextValue(Value)); }
+	void AddValueActor(AActor* Value) { AddValue(FSussContextValue(Value)); }
 	UFUNCTION(BlueprintCallable)
-	void AddValueVector(FVector Value) { TempOutArray->Add(FSussContextValue(Value)); }
+	void AddValueVector(FVector Value) { AddValue(FSussContextValue(Value)); }
 	UFUNCTION(BlueprintCallable)
-	void AddValueRotator(FRotator Value) { TempOutArray->Add(FSussContextValue(Value)); }
+	void AddValueRotator(FRotator Value) { AddValue(FSussContextValue(Value)); }
 	UFUNCTION(BlueprintCallable)
-	void AddValueTag(FGameplayTag Value) { TempOutArray->Add(FSussContextValue(Value)); }
+	void AddValueTag(FGameplayTag Value) { AddValue(FSussContextValue(Value)); }
 	UFUNCTION(BlueprintCallable)
-	void AddValueName(FName Value) { TempOutArray->Add(FSussContextValue(Value)); }
+	void AddValueName(FName Value) { AddValue(FSussContextValue(Value)); }
 	UFUNCTION(BlueprintCallable)
-	void AddValueFloat(float Value) { TempOutArray->Add(FSussContextValue(Value)); }
+	void AddValueFloat(float Value) { AddValue(FSussContextValue(Value)); }
 	UFUNCTION(BlueprintCallable)
-	void AddValueInt(int Value) { TempOutArray->Add(FSussContextValue(Value)); }
+	void AddValueInt(int Value) { AddValue(FSussContextValue(Value)); }
 	
 	/// Add a struct as a shared pointer (C++ only)
 	void AddValueStruct(const TSharedPtr<const FSussContextValueStructBase>& Struct);
@@ -462,23 +685,22 @@ protected:
 	UFUNCTION(BlueprintImplementableEvent, DisplayName="ExecuteQuery", meta=(ForceAsFunction))
 	void ExecuteQueryBP(USussBrainComponent* Brain, AActor* ControlledActor, const TMap<FName, FSussParameter>& Params, const FSussContext& BaseContext);
 
+	/// Run ExecuteQuery with OutResults as the target of AddValue on this thread
+	void ExecuteQueryWithOutArray(USussBrainComponent* Brain,
+	                              AActor* Self,
+	                              const TMap<FName, FSussParameter>& Params,
+	                              const FSussContext& Context,
+	                              TArray<FSussContextValue>& OutResults);
+
 	virtual void ExecuteQueryInternal(USussBrainComponent* Brain, AActor* Self, const TMap<FName, FSussParameter>& Params, TSussResultsArray& OutResults) override final
 	{
 		InitResults<FSussContextValue>(OutResults);
-		// We have to store local version so BP can interact using helper functions
-		TempOutArray = &(OutResults.Get<TArray<FSussContextValue>>());
-		ExecuteQuery(Brain, Self, Params, FSussContext {Self}, GetResultsArray<FSussContextValue>(OutResults));
-		TempOutArray = nullptr;
-
+		ExecuteQueryWithOutArray(Brain, Self, Params, FSussContext {Self}, GetResultsArray<FSussContextValue>(OutResults));
 	}
 
 	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, TArray<FSussContextValue>& OutResults) override final
 	{
-		// We have to store local version so BP can interact using helper functions
-		TempOutArray = &OutResults;
-		ExecuteQuery(Brain, Self, Params, Context, OutResults);
-		TempOutArray = nullptr;
-
+		ExecuteQueryWithOutArray(Brain, Self, Params, Context, OutResults);
 	}
 	virtual void ExecuteQueryInContextInternal(USussBrainComponent* Brain, AActor* Self, const FSussContext& Context, const TMap<FName, FSussParameter>& Params, TArray<TWeakObjectPtr<AActor>>& OutResults) override final
 	{
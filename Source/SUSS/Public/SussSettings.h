@@ -59,6 +59,33 @@ public:
 	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "The frame time budget in milliseconds for running updates on AI brains"))
 	float BrainUpdateFrameTimeBudgetMilliseconds = 0.5f;
 	
+	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "Whether to use any brain update frame time budget left over to run queries ahead of time for brains which are about to update, so that their updates mostly use cached results"))
+	bool PrefetchQueriesInSpareFrameTime = true;
+
+	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "How far ahead in seconds to look when prefetching queries; brains due to update within this time have their queries prefetched, and cached results expiring within this time are refreshed"))
+	float QueryPrefetchLookaheadSeconds = 0.1f;
+
+	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "Custom curves on considerations are baked into lookup tables; if the max error of a baked curve compared to the source curve exceeds this, a warning is logged suggesting a higher resolution"))
+	float CustomCurveBakeErrorWarningThreshold = 0.01f;
+
+	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "How often in seconds to trim the pool of re-usable arrays & maps; free containers beyond what's recently been needed are released, as are the largest buffers if over the memory cap"))
+	float PoolTrimIntervalSeconds = 10.0f;
+
+	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "The maximum memory in kilobytes that free pooled arrays & maps can hold on to after trimming"))
+	int PoolFreeMemoryCapKilobytes = 1024;
+
+	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "Brain configs whose actions should be instantiated ahead of time when a map is loaded, to avoid hitches the first time they're used. Brain configs used by spawned brains are pre-warmed automatically."))
+	TArray<TSoftObjectPtr<class USussBrainConfigAsset>> PrewarmBrainConfigs;
+
+	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "Action sets whose actions should be instantiated ahead of time when a map is loaded, to avoid hitches the first time they're used"))
+	TArray<TSoftObjectPtr<class USussActionSetAsset>> PrewarmActionSets;
+
+	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "How many instances of each action class to create ahead of time when pre-warming"))
+	int ActionPrewarmCountPerClass = 2;
+
+	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "The maximum number of action instances to create per frame when pre-warming, so the cost is spread over several frames"))
+	int ActionPrewarmMaxPerFrame = 4;
+
 	UPROPERTY(config, EditAnywhere, Category = Optimisation, meta = (ToolTip = "Whether perception changes trigger an immediate decision update of brains (e.g. spotting an enemy)"))
 	bool BrainUpdateOnPerceptionChanges = true;
 
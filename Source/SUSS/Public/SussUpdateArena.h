@@ -0,0 +1,112 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "SussContext.h"
+#include "SussParameter.h"
+#include "HAL/ThreadSingleton.h"
+
+/**
+ * Per-thread linear arena for the transient containers used while updating a brain (resolved parameters, query
+ * results being combined into contexts). Like FMemStack, containers are handed out in order and all given back when
+ * the FSussUpdateArenaMark they were acquired under goes out of scope. Containers keep their allocations when given
+ * back, so once warmed up, acquiring them never allocates or takes a lock.
+ *
+ * Everything acquired is only valid until the enclosing mark is destroyed.
+ */
+class SUSS_API FSussUpdateArena : public TThreadSingleton<FSussUpdateArena>
+{
+public:
+	template<typename T>
+	TArray<T>& AcquireArray()
+	{
+		check(NumMarks > 0);
+		return GetArraySlots<T>().Acquire();
+	}
+
+	template<typename K, typename V>
+	TMap<K,V>& AcquireMap()
+	{
+		check(NumMarks > 0);
+		return GetMapSlots<K,V>().Acquire();
+	}
+
+protected:
+	friend struct FSussUpdateArenaMark;
+
+	template<typename C>
+	struct TSlots
+	{
+		TArray<TUniquePtr<C>> Items;
+		int NumUsed = 0;
+
+		C& Acquire()
+		{
+			if (NumUsed == Items.Num())
+			{
+				Items.Add(MakeUnique<C>());
+			}
+			return *Items[NumUsed++];
+		}
+
+		void ReleaseTo(int Mark)
+		{
+			// Reset, not Empty, so the allocation is kept for next time
+			for (int i = Mark; i < NumUsed; ++i)
+			{
+				Items[i]->Reset();
+			}
+			NumUsed = Mark;
+		}
+	};
+
+	int NumMarks = 0;
+	TSlots<TArray<TWeakObjectPtr<AActor>>> ActorArrays;
+	TSlots<TArray<FVector>> LocationArrays;
+	TSlots<TArray<FSussContextValue>> ValueArrays;
+	TSlots<TMap<FName, FSussParameter>> ParameterMaps;
+
+	template<typename T>
+	TSlots<TArray<T>>& GetArraySlots();
+	template<typename K, typename V>
+	TSlots<TMap<K,V>>& GetMapSlots();
+};
+
+template<>
+inline FSussUpdateArena::TSlots<TArray<TWeakObjectPtr<AActor>>>& FSussUpdateArena::GetArraySlots<TWeakObjectPtr<AActor>>() { return ActorArrays; }
+template<>
+inline FSussUpdateArena::TSlots<TArray<FVector>>& FSussUpdateArena::GetArraySlots<FVector>() { return LocationArrays; }
+template<>
+inline FSussUpdateArena::TSlots<TArray<FSussContextValue>>& FSussUpdateArena::GetArraySlots<FSussContextValue>() { return ValueArrays; }
+template<>
+inline FSussUpdateArena::TSlots<TMap<FName, FSussParameter>>& FSussUpdateArena::GetMapSlots<FName, FSussParameter>() { return ParameterMaps; }
+
+/// Scope within which containers can be acquired from this thread's FSussUpdateArena; they're given back when this is destroyed
+struct FSussUpdateArenaMark
+{
+	FSussUpdateArena& Arena;
+	int ActorArraysMark;
+	int LocationArraysMark;
+	int ValueArraysMark;
+	int ParameterMapsMark;
+
+	FSussUpdateArenaMark() : Arena(FSussUpdateArena::Get()),
+		ActorArraysMark(Arena.ActorArrays.NumUsed),
+		LocationArraysMark(Arena.LocationArrays.NumUsed),
+		ValueArraysMark(Arena.ValueArrays.NumUsed),
+		ParameterMapsMark(Arena.ParameterMaps.NumUsed)
+	{
+		++Arena.NumMarks;
+	}
+
+	~FSussUpdateArenaMark()
+	{
+		Arena.ActorArrays.ReleaseTo(ActorArraysMark);
+		Arena.LocationArrays.ReleaseTo(LocationArraysMark);
+		Arena.ValueArrays.ReleaseTo(ValueArraysMark);
+		Arena.ParameterMaps.ReleaseTo(ParameterMapsMark);
+		--Arena.NumMarks;
+	}
+
+	FSussUpdateArenaMark(const FSussUpdateArenaMark&) = delete;
+	FSussUpdateArenaMark& operator=(const FSussUpdateArenaMark&) = delete;
+};
@@ -213,7 +213,7 @@ public:
 	 * @return A list of locations from the query
 	 */
 	UFUNCTION(BlueprintCallable, Category="SUSS")
-	static const TArray<FVector>& RunLocationQuery(AActor* Querier, FGameplayTag Tag, const TMap<FName, FSussParameter>& Params, float UseCachedResultsFor = 0);
+	static TArray<FVector> RunLocationQuery(AActor* Querier, FGameplayTag Tag, const TMap<FName, FSussParameter>& Params, float UseCachedResultsFor = 0);
 
 	/**
 	 * Manually run a query that returns locations, rather than use it to generate context for a brain decision, and supply a target context.
@@ -228,7 +228,7 @@ public:
 	 * @return A list of locations from the query
 	 */
 	UFUNCTION(BlueprintCallable, Category="SUSS")
-	static const TArray<FVector>& RunLocationQueryWithTargetContext(AActor* Querier, FGameplayTag Tag, AActor* Target, const TMap<FName, FSussParameter>& Params, float UseCachedResultsFor = 0);
+	static TArray<FVector> RunLocationQueryWithTargetContext(AActor* Querier, FGameplayTag Tag, AActor* Target, const TMap<FName, FSussParameter>& Params, float UseCachedResultsFor = 0);
 	/**
 	 * Manually run a query that returns target actors, rather than use it to generate context for a brain decision.
 	 * You might want to do this if you want some query results to manually choose inside an action, rather than evaluating
@@ -251,6 +251,8 @@ public:
 	static float EvalExponentialCurve(float Input, const FVector4f& Params);
 	static float EvalLogisticCurve(float Input, const FVector4f& Params);
 	static float EvalCurve(ESussCurveType CurveType, float Input, const FVector4f& Params);
+	/// Evaluate a (non-custom) curve for a whole batch of inputs at once, writing to OutScores which must be the same size
+	static void EvalCurveBatch(ESussCurveType CurveType, TConstArrayView<float> Inputs, TArrayView<float> OutScores, const FVector4f& Params);
 
 	/**
 	 * Get the distance along navmesh paths from an actor's current location to a desired location.
@@ -4,10 +4,12 @@
 
 #include "CoreMinimal.h"
 #include "Containers/Queue.h"
+#include "SussBrainStateStore.h"
 #include "Subsystems/WorldSubsystem.h"
 #include "SussWorldSubsystem.generated.h"
 
 class USussBrainComponent;
+struct FSussScopedPerfTimer;
 /**
  * World-scope subsystem used to manage brains which need updating.
  */
@@ -20,11 +22,25 @@ protected:
 	/// will be scheduled for the next frame
 	float CachedFrameTimeBudgetMs;
 
+	/// Whether to spend leftover frame budget prefetching queries for brains about to update
+	bool bCachedPrefetchQueries;
+	/// How far ahead to look when deciding which brains & cached query results to prefetch
+	float CachedPrefetchLookaheadSeconds;
+
 	/// Brains which need updating, FIFO
 	TQueue<TWeakObjectPtr<USussBrainComponent>> BrainsToUpdate;
 
+	/// All brains with running logic, used for query prefetching
+	TArray<TWeakObjectPtr<USussBrainComponent>> RegisteredBrains;
+	/// Round-robin position in RegisteredBrains so prefetching doesn't always favour the same brains
+	int NextPrefetchBrainIndex = 0;
+
+	/// Hot decision state of every brain in this world
+	FSussBrainStateStore BrainStates;
+
 	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
 	void UpdateBrains();
+	void PrefetchQueries(FSussScopedPerfTimer& Timer);
 
 public:
 
@@ -36,6 +52,14 @@ public:
 	/// Queue a brain to be updated
 	void QueueBrainUpdate(USussBrainComponent* Brain);
 
+	/// Register a brain whose logic is running, so it can be considered for query prefetching
+	void RegisterBrain(USussBrainComponent* Brain);
+	/// Unregister a brain whose logic has stopped
+	void UnregisterBrain(USussBrainComponent* Brain);
+
+	/// Decision state storage for brains in this world, brains hold an FSussBrainHandle into it
+	FSussBrainStateStore& GetBrainStates() { return BrainStates; }
+
 	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
 	virtual bool IsTickableWhenPaused() const override { return false; }
 	virtual TStatId GetStatId() const override;